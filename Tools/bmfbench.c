@@ -0,0 +1,507 @@
+/*
+    bmfbench.c - Throughput benchmark for the BMF decoder
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+/*
+ * Inputs are captured WQxx buffers ('FOMB' header + DS-01 stream) or
+ * synthetic MOF-like data compressed with bmf_enc(). Every decoder is
+ * checked against ds_dec_ref() before it is timed. Results are printed
+ * as a table, or as one JSON object per line with -j for comparing runs
+ * across commits. The literal share of the output and the speedup over
+ * ds_dec_ref are printed per input, as the fast path of ds_dec depends
+ * on both. With -c nothing is timed: random inputs of random sizes, and
+ * damaged copies of them, are run through every decoder instead.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "../YogaSMC/bmfdec.h"
+#include "bmfenc.h"
+#include "bmftpl.h"
+
+typedef struct {
+    char name[64];
+    uint8_t *bmf;       // 'FOMB' header + stream
+    int len;
+    int size;           // decompressed size
+    uint8_t *ref;       // ds_dec_ref output
+    uint64_t hash;      // FNV-1a of ref
+    uint32_t sum;       // checksum of ref, see tpl_feed
+    ds_count_t cnt;     // ds_probe counts
+} input_t;
+
+typedef struct {
+    const char *name;
+    int (*run)(input_t *in, uint8_t *out);
+    int writes;         // output is compared against ref
+} decoder_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int run_ref(input_t *in, uint8_t *out)
+{
+    return ds_dec_ref(in->bmf + 16, in->len - 16, out, in->size, 0);
+}
+
+static int run_dec(input_t *in, uint8_t *out)
+{
+    return ds_dec(in->bmf + 16, in->len - 16, out, in->size, 0);
+}
+
+
+static int run_probe(input_t *in, uint8_t *out)
+{
+    (void)out;
+    return ds_probe(in->bmf + 16, in->len - 16, in->size, 0, NULL);
+}
+
+static int run_stream(input_t *in, uint8_t *out)
+{
+    static ds_stream_t s;
+    int n, pos = 0;
+
+    ds_stream_init(&s, in->size, 0);
+    ds_stream_feed(&s, in->bmf + 16, in->len - 16, 1);
+    // drain in 4 KiB pieces like a bounded consumer would
+    while ((n = ds_stream_drain(&s, out + pos, in->size - pos < 4096 ? in->size - pos : 4096)) > 0)
+        pos += n;
+    return n < 0 ? n : pos;
+}
+
+/*
+ * Input in chunks of 1 to 64 bytes, each in a buffer of its own size and
+ * freed before the next one is fed, so reading past a chunk or keeping a
+ * pointer into it shows up under ASan. Sizes come from a small LCG to
+ * leave the rand() sequence of the damaged copies alone.
+ */
+static int run_stream_chunks(input_t *in, uint8_t *out)
+{
+    static ds_stream_t s;
+    unsigned seed = (unsigned)in->len * 2654435761U;
+    int n = 0, pos = 0, off = 16, k;
+    uint8_t *chunk;
+
+    ds_stream_init(&s, in->size, 0);
+    // an empty stream still gets its last chunk
+    do {
+        seed = seed * 1103515245 + 12345;
+        k = 1 + (seed >> 16) % 64;
+        if (k > in->len - off)
+            k = in->len - off;
+        chunk = malloc(k ? k : 1);
+        memcpy(chunk, in->bmf + off, k);
+        off += k;
+        ds_stream_feed(&s, chunk, k, off == in->len);
+        while ((n = ds_stream_drain(&s, out + pos, in->size - pos)) > 0)
+            pos += n;
+        free(chunk);
+    } while (off < in->len && n >= 0);
+    return n < 0 ? n : pos;
+}
+
+// template instantiations, a wrong side result counts as a failed decode
+static int run_tpl_dec(input_t *in, uint8_t *out)
+{
+    return tpl_dec(in->bmf + 16, in->len - 16, out, in->size);
+}
+
+static int run_tpl_count(input_t *in, uint8_t *out)
+{
+    ds_count_t cnt;
+    int r = tpl_count(in->bmf + 16, in->len - 16, in->size, &cnt);
+
+    (void)out;
+    return memcmp(&cnt, &in->cnt, sizeof(cnt)) ? -3 : r;
+}
+
+static int run_tpl_hash(input_t *in, uint8_t *out)
+{
+    uint64_t hash;
+    int r = tpl_hash(in->bmf + 16, in->len - 16, out, in->size, &hash);
+
+    return hash != in->hash ? -3 : r;
+}
+
+static int run_tpl_feed(input_t *in, uint8_t *out)
+{
+    uint32_t sum;
+    int r = tpl_feed(in->bmf + 16, in->len - 16, out, in->size, &sum);
+
+    return sum != in->sum ? -3 : r;
+}
+
+// odd steps so the pauses land inside tokens and sync blocks
+static int run_tpl_upto(input_t *in, uint8_t *out)
+{
+    return tpl_upto(in->bmf + 16, in->len - 16, out, in->size, 1000);
+}
+
+static const decoder_t decoders[] = {
+    {"ds_dec_ref", run_ref, 1},
+    {"ds_dec", run_dec, 1},
+    {"ds_probe", run_probe, 0},
+    {"ds_stream", run_stream, 1},
+    {"ds_stream/64", run_stream_chunks, 1},
+    {"tpl_dec", run_tpl_dec, 1},
+    {"tpl_count", run_tpl_count, 0},
+    {"tpl_hash", run_tpl_hash, 1},
+    {"tpl_feed", run_tpl_feed, 1},
+    {"tpl_upto", run_tpl_upto, 1},
+};
+#define NDECODERS (sizeof(decoders) / sizeof(decoders[0]))
+
+// MOF-like filler: UTF-16 identifiers, small integers, padding and noise
+static uint8_t *synth_mof(int size, unsigned seed)
+{
+    static const char *words[] = {
+        "ID", "CIMTYPE", "WmiDataId", "Description", "ValueMap", "Values",
+        "__CLASS", "Lenovo_BiosSetting", "CurrentSetting", "Active",
+        "InstanceName", "string", "sint32", "boolean", "guid", "WmiMethodId",
+    };
+    uint8_t *out = malloc(size + 256);
+    int pos = 0, i;
+
+    srand(seed);
+    while (pos < size) {
+        int r = rand() % 10;
+        if (r < 6) {
+            const char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+            for (i = 0; w[i]; i++) {
+                out[pos++] = w[i];
+                out[pos++] = 0;
+            }
+            out[pos++] = 0;
+            out[pos++] = 0;
+        } else if (r < 8) {
+            uint32_t v = rand() % 300;
+            memcpy(out + pos, &v, 4);
+            pos += 4;
+        } else if (r < 9) {
+            i = 1 + rand() % 40;
+            memset(out + pos, 0, i);
+            pos += i;
+        } else {
+            for (i = 1 + rand() % 30; i; i--)
+                out[pos++] = rand();
+        }
+    }
+    return out;
+}
+
+// Literal-heavy filler: noise with few repeats, mostly 9-bit literal codes
+static uint8_t *synth_lit(int size, unsigned seed)
+{
+    uint8_t *out = malloc(size + 256);
+    int pos;
+
+    srand(seed);
+    for (pos = 0; pos < size; pos++)
+        out[pos] = rand() >> 7;
+    return out;
+}
+
+static int add_synthetic(input_t *in, int size, unsigned seed, int lit)
+{
+    uint8_t *raw = lit ? synth_lit(size, seed) : synth_mof(size, seed);
+
+    // 8 bytes of zeros past the end as add_file leaves, damaged copies take them too
+    in->bmf = calloc(BMF_ENC_BOUND(size) + 8, 1);
+    in->len = bmf_enc(raw, size, in->bmf, BMF_ENC_BOUND(size));
+    in->size = size;
+    snprintf(in->name, sizeof(in->name), "%s-%d", lit ? "literal" : "synthetic", size);
+    free(raw);
+    return in->len < 0 ? -1 : 0;
+}
+
+static int add_file(input_t *in, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    const char *base = strrchr(path, '/');
+    uint32_t hdr[4];
+    long len;
+
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    in->bmf = calloc(len + 8, 1);
+    if (len <= 16 || fread(in->bmf, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        fclose(f);
+        free(in->bmf);
+        return -1;
+    }
+    fclose(f);
+    memcpy(hdr, in->bmf, sizeof(hdr));
+    if (hdr[0] != 0x424D4F46 || hdr[1] != 0x01 || hdr[2] != (uint32_t)len - 16 || hdr[3] > 0x10000000) {
+        fprintf(stderr, "%s: not a BMF blob\n", path);
+        free(in->bmf);
+        return -1;
+    }
+    in->len = (int)len;
+    in->size = hdr[3];
+    snprintf(in->name, sizeof(in->name), "%s", base ? base + 1 : path);
+    return 0;
+}
+
+// ds_dec_ref output and the side results the template sinks are checked against
+static int prepare(input_t *in)
+{
+    in->ref = malloc(in->size + 64);
+    if (run_ref(in, in->ref) != in->size || ds_probe(in->bmf + 16, in->len - 16, in->size, 0, &in->cnt) != in->size) {
+        fprintf(stderr, "%s: decompress failed\n", in->name);
+        return -1;
+    }
+    in->hash = 0xcbf29ce484222325ULL;
+    in->sum = 0;
+    for (int k = 0; k < in->size; k++) {
+        in->hash = (in->hash ^ in->ref[k]) * 0x100000001b3ULL;
+        in->sum = in->sum * 31 + in->ref[k];
+    }
+    return 0;
+}
+
+// every decoder once, byte for byte against ds_dec_ref
+static int verify(input_t *in, uint8_t *out)
+{
+    unsigned d;
+
+    for (d = 0; d < NDECODERS; d++) {
+        const decoder_t *dec = &decoders[d];
+
+        memset(out, 0, in->size);
+        if (dec->run(in, out) != in->size || (dec->writes && memcmp(out, in->ref, in->size))) {
+            fprintf(stderr, "%s: %s output differs from ds_dec_ref\n", in->name, dec->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Damaged stream: flipped bits and a truncation. Every decoder has to
+ * agree with ds_dec_ref on success or failure, and on the output when
+ * it succeeds; the template sinks only report their own result.
+ */
+static int verify_damaged(input_t *in, unsigned seed)
+{
+    input_t bad = *in;
+    uint8_t *ref = malloc(in->size + 64), *out = malloc(in->size + 64);
+    int i, r, want, ret = 0;
+    unsigned d;
+
+    srand(seed);
+    bad.bmf = malloc(in->len + 8);
+    memcpy(bad.bmf, in->bmf, in->len + 8);
+    for (i = rand() % 4; i >= 0; i--)
+        bad.bmf[16 + rand() % (in->len - 16)] ^= 1 << (rand() % 8);
+    if (rand() % 2) {
+        bad.len = 16 + rand() % (in->len - 16);
+        // ds_dec_ref loads a whole 16-bit word at an odd end, ds_dec pads with zeros
+        memset(bad.bmf + bad.len, 0, in->len + 8 - bad.len);
+    }
+    snprintf(bad.name, sizeof(bad.name), "%.40s~%u", in->name, seed);
+
+    want = run_ref(&bad, ref);
+    for (d = 1; d < NDECODERS && !ret; d++) {
+        const decoder_t *dec = &decoders[d];
+
+        if (dec->run == run_tpl_count || dec->run == run_tpl_hash || dec->run == run_tpl_feed)
+            continue;
+        r = dec->run(&bad, out);
+        if ((r < 0) != (want < 0) || (want >= 0 && (r != want || (dec->writes && memcmp(out, ref, want))))) {
+            fprintf(stderr, "%s: %s returned %d, ds_dec_ref %d\n", bad.name, dec->name, r, want);
+            ret = -1;
+        }
+    }
+    free(bad.bmf);
+    free(out);
+    free(ref);
+    return ret;
+}
+
+// random sizes of both fillers, each also damaged a few times
+static int check(int rounds, input_t *files, int nfiles)
+{
+    int i, j, fails = 0;
+
+    for (i = 0; i < rounds + nfiles; i++) {
+        input_t gen = {0}, *in = i < nfiles ? &files[i] : &gen;
+        uint8_t *out;
+
+        if (i >= nfiles) {
+            srand(i);
+            // mostly small, so the tails and the first sync block get most of the rounds
+            int size = 1 + (i % 4 ? rand() % 4096 : rand() % 262144);
+            if (add_synthetic(&gen, size, i, i % 3 == 0) < 0)
+                return 1;
+        }
+        out = malloc(in->size + 64);
+        if (prepare(in) < 0 || verify(in, out) < 0)
+            fails++;
+        else
+            for (j = 0; j < 8; j++)
+                if (verify_damaged(in, i * 8 + j) < 0)
+                    fails++;
+        free(out);
+        free(in->ref);
+        free(in->bmf);
+    }
+    printf("%d inputs, %u decoders, %d failures\n", rounds + nfiles, (unsigned)NDECODERS, fails);
+    return fails != 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bmfbench [-j] [-t seconds] [-s size]... [-l size]... [file.bmf]...\n"
+                    "       bmfbench -c rounds [file.bmf]...\n"
+                    "  -j  print one JSON object per result\n"
+                    "  -t  minimum time per measurement (default 0.2)\n"
+                    "  -s  add a synthetic input of the given decompressed size\n"
+                    "  -l  add a literal-heavy synthetic input of the given size\n"
+                    "  -c  no timing, compare every decoder on the files and on\n"
+                    "      rounds random inputs, intact and damaged\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    input_t *inputs;
+    int ninputs = 0, json = 0, rounds = -1, opt, i, ret;
+    double mintime = 0.2;
+    unsigned d;
+
+    inputs = calloc(argc + 1, sizeof(input_t));
+    while ((opt = getopt(argc, argv, "jt:s:l:c:")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = 1;
+                break;
+            case 't':
+                mintime = atof(optarg);
+                break;
+            case 's':
+            case 'l':
+                if (add_synthetic(&inputs[ninputs], (int)strtol(optarg, NULL, 0), ninputs + 1, opt == 'l') == 0)
+                    ninputs++;
+                break;
+            case 'c':
+                rounds = (int)strtol(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    for (i = optind; i < argc; i++)
+        if (add_file(&inputs[ninputs], argv[i]) == 0)
+            ninputs++;
+        else if (rounds >= 0) {
+            free(inputs);
+            return 1;
+        }
+    if (rounds >= 0) {
+        ret = check(rounds, inputs, ninputs);
+        free(inputs);
+        return ret;
+    }
+    if (ninputs == 0)
+        usage();
+
+    if (!json)
+        printf("%-24s %-12s %10s %10s %6s %10s %10s %8s %7s\n",
+               "input", "decoder", "in", "out", "lit%", "MB/s", "Mtok/s", "cyc/B", "x ref");
+
+    for (i = 0; i < ninputs; i++) {
+        input_t *in = &inputs[i];
+        uint8_t *out = malloc(in->size + 64);
+        ds_count_t cnt;
+        uint32_t tokens;
+        double litpct, refmbps = 0;
+
+        if (prepare(in) < 0 || verify(in, out) < 0)
+            return 1;
+        cnt = in->cnt;
+        tokens = cnt.lits + cnt.reps + cnt.syncs;
+        litpct = in->size ? 100.0 * cnt.lits / in->size : 0;
+
+        for (d = 0; d < NDECODERS; d++) {
+            const decoder_t *dec = &decoders[d];
+            double t0, t = 0;
+            uint64_t c0, c = 0;
+            long iter = 0, n = 1;
+
+            // double the batch until it runs long enough to time
+            while (t < mintime) {
+                long k;
+                t0 = now();
+                c0 = cycles();
+                for (k = 0; k < n; k++)
+                    dec->run(in, out);
+                c = cycles() - c0;
+                t = now() - t0;
+                iter = n;
+                n *= 2;
+            }
+
+            double bytes = (double)in->size * iter;
+            double mbps = bytes / t / 1e6;
+            double mtps = (double)tokens * iter / t / 1e6;
+            double cpb = c ? c / bytes : 0;
+            if (dec->run == run_ref)
+                refmbps = mbps;
+            double speedup = refmbps ? mbps / refmbps : 0;
+            if (json)
+                printf("{\"input\":\"%s\",\"decoder\":\"%s\",\"in_bytes\":%d,\"out_bytes\":%d,"
+                       "\"tokens\":%u,\"literals\":%u,\"matches\":%u,\"literal_pct\":%.1f,"
+                       "\"iterations\":%ld,\"seconds\":%.6f,\"mb_per_s\":%.2f,\"tokens_per_s\":%.0f,"
+                       "\"cycles_per_byte\":%.3f,\"speedup_vs_ref\":%.2f}\n",
+                       in->name, dec->name, in->len, in->size, tokens, cnt.lits, cnt.reps, litpct,
+                       iter, t, mbps, mtps * 1e6, cpb, speedup);
+            else
+                printf("%-24s %-12s %10d %10d %6.1f %10.1f %10.2f %8.2f %6.2fx\n",
+                       in->name, dec->name, in->len, in->size, litpct, mbps, mtps, cpb, speedup);
+        }
+        free(out);
+        free(in->ref);
+        free(in->bmf);
+    }
+    free(inputs);
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+    bmfenc.c - Compress binary MOF data into a BMF (DS-01) stream
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+/*
+ * Inverse of ds_dec() in YogaSMC/bmfdec.c. Bits are packed LSB first
+ * into little-endian 16-bit words:
+ *   literal  01 + 7 bits (byte|128), 10 + 7 bits (byte&127)
+ *   offset   00 + 6 bits, 011 + 8 bits (-64), 111 + 12 bits (-320)
+ *   length   n zero bits, a one, n bits; value (1<<n)+2+bits = length+1
+ *   sync     offset 0x113f, emitted at every 512 bytes of output and at
+ *            the end of the stream
+ * Matches never cross a 512-byte boundary so that each sync lands on it.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmfenc.h"
+
+#define ENC_HBITS 14
+#define ENC_DEPTH 32
+#define ENC_MAXOFF 0x113e	/* 0x113f is the sync marker */
+#define ENC_MAXREP 512
+#define ENC_RING 8192		/* > ENC_MAXOFF */
+#define ENC_SYNC 512
+
+typedef struct {
+    uint64_t acc;
+    int n;
+    uint8_t *p, *pe;
+    int err;
+} bw_t;
+
+static void bw_put(bw_t *w, unsigned v, int n)
+{
+    w->acc |= (uint64_t)v << w->n;
+    w->n += n;
+    while (w->n >= 16) {
+        if (w->pe - w->p >= 2) {
+            w->p[0] = w->acc & 0xff;
+            w->p[1] = (w->acc >> 8) & 0xff;
+            w->p += 2;
+        } else {
+            w->err = 1;
+        }
+        w->acc >>= 16;
+        w->n -= 16;
+    }
+}
+
+static void bw_lit(bw_t *w, uint8_t c)
+{
+    if (c & 128)
+        bw_put(w, 1 | ((c & 127) << 2), 9);
+    else
+        bw_put(w, 2 | (c << 2), 9);
+}
+
+static void bw_off(bw_t *w, unsigned off)
+{
+    if (off < 64)
+        bw_put(w, off << 2, 8);
+    else if (off < 320)
+        bw_put(w, 3 | ((off - 64) << 3), 11);
+    else
+        bw_put(w, 7 | ((off - 320) << 3), 15);
+}
+
+static void bw_len(bw_t *w, unsigned len)
+{
+    unsigned v = len + 1;
+    int t = 0;
+    while (v - 2 >= (2u << t))
+        t++;
+    bw_put(w, 1u << t, t + 1);
+    if (t)
+        bw_put(w, v - (1u << t) - 2, t);
+}
+
+static unsigned hash3(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - ENC_HBITS);
+}
+
+int ds_enc(const void *pin, int lin, void *pout, int lout)
+{
+    const uint8_t *in = (const uint8_t *)pin;
+    int *head, *prev;
+    bw_t w = {0, 0, (uint8_t *)pout, (uint8_t *)pout + lout, 0};
+    int i, j, k;
+
+    if (lin < 0)
+        return -1;
+    head = (int *)malloc(sizeof(int) << ENC_HBITS);
+    prev = (int *)malloc(sizeof(int) * ENC_RING);
+    if (!head || !prev) {
+        free(head);
+        free(prev);
+        return -1;
+    }
+    for (i = 0; i < 1 << ENC_HBITS; i++)
+        head[i] = -1;
+
+    bw_put(&w, 0x5344, 16);     // 'DS'
+    bw_put(&w, 0x0100, 16);     // version 1, byte swapped by the decoder
+
+    for (i = 0; i < lin; ) {
+        int lim = (i / ENC_SYNC + 1) * ENC_SYNC;
+        int best = 0, boff = 0;
+
+        if (i && i % ENC_SYNC == 0)
+            bw_put(&w, 7 | (4095 << 3), 15);
+        if (lim > lin)
+            lim = lin;
+        if (lim - i > ENC_MAXREP)
+            lim = i + ENC_MAXREP;
+
+        if (lin - i >= 3) {
+            int depth = ENC_DEPTH;
+            for (j = head[hash3(in + i)]; j >= 0 && depth--; j = prev[j % ENC_RING]) {
+                int off = i - j;
+                if (off > ENC_MAXOFF)
+                    break;
+                for (k = 0; i + k < lim && in[j + k] == in[i + k]; k++)
+                    ;
+                if (k > best) {
+                    best = k;
+                    boff = off;
+                    if (i + k == lim)
+                        break;
+                }
+            }
+        }
+
+        if (best < 3)
+            best = 1;
+        for (k = 0; k < best; k++, i++) {
+            if (lin - i >= 3) {
+                unsigned h = hash3(in + i);
+                prev[i % ENC_RING] = head[h];
+                head[h] = i;
+            }
+        }
+        if (best == 1) {
+            bw_lit(&w, in[i - 1]);
+        } else {
+            bw_off(&w, boff);
+            bw_len(&w, best);
+        }
+    }
+
+    bw_put(&w, 7 | (4095 << 3), 15);
+    if (w.n)
+        bw_put(&w, 0, 16 - w.n);
+
+    free(head);
+    free(prev);
+    return w.err ? -1 : (int)(w.p - (uint8_t *)pout);
+}
+
+int bmf_enc(const void *pin, int lin, void *pout, int lout)
+{
+    uint8_t *out = (uint8_t *)pout;
+    uint32_t hdr[4];
+    int len;
+
+    if (lout < 16)
+        return -1;
+    len = ds_enc(pin, lin, out + 16, lout - 16);
+    if (len < 0)
+        return -1;
+    // host is little endian, as in WMI::extractBMF()
+    hdr[0] = 0x424D4F46;
+    hdr[1] = 0x01;
+    hdr[2] = len;
+    hdr[3] = lin;
+    memcpy(out, hdr, sizeof(hdr));
+    return len + 16;
+}
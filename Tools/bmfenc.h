@@ -0,0 +1,27 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfenc.h
+//  YogaSMC host tools
+//
+
+#ifndef bmfenc_h
+#define bmfenc_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Worst case: 9-bit literals, a 15-bit sync every 512 bytes, header and padding
+#define DS_ENC_BOUND(n) ((n) + (n) / 8 + ((n) / 512 + 2) * 2 + 8)
+#define BMF_ENC_BOUND(n) (DS_ENC_BOUND(n) + 16)
+
+// Compress lin bytes into a DS-01 stream, returns the compressed size or -1
+int ds_enc(const void *pin, int lin, void *pout, int lout);
+// Same with the 16-byte 'FOMB' header expected by WMI::extractBMF()
+int bmf_enc(const void *pin, int lin, void *pout, int lout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* bmfenc_h */
@@ -0,0 +1,74 @@
+/*
+    bmftpl.cpp - C entry points for the ds:: template decoders
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include "bmftpl.h"
+
+int tpl_dec(void *pin, int lin, void *pout, int lout)
+{
+    ds::BufferSink sink(pout);
+    return ds::decode<ds::Strict>(pin, lin, lout, sink);
+}
+
+int tpl_count(void *pin, int lin, int lout, ds_count_t *cnt)
+{
+    ds::CountSink sink;
+    int r = ds::decode<ds::Strict>(pin, lin, lout, sink);
+    if (cnt)
+        *cnt = sink.cnt;
+    return r;
+}
+
+int tpl_hash(void *pin, int lin, void *pout, int lout, uint64_t *hash)
+{
+    ds::HashSink sink(pout);
+    int r = ds::decode<ds::Strict>(pin, lin, lout, sink);
+    *hash = sink.hash;
+    return r;
+}
+
+// Stand-in for a streaming parser, folds the blocks it is fed
+struct Checksum {
+    uint32_t sum {0};
+    int bytes {0};
+
+    void feed(const uint8_t *data, int len) {
+        for (int i = 0; i < len; i++)
+            sum = sum * 31 + data[i];
+        bytes += len;
+    }
+};
+
+int tpl_feed(void *pin, int lin, void *pout, int lout, uint32_t *sum)
+{
+    Checksum parser;
+    ds::FeedSink<Checksum> sink(pout, parser);
+    int r = ds::decode<ds::Strict>(pin, lin, lout, sink);
+    *sum = parser.sum;
+    return r < 0 || parser.bytes == r ? r : -3;
+}
+
+int tpl_upto(void *pin, int lin, void *pout, int lout, int step)
+{
+    ds::Decoder<ds::Strict, ds::BufferSink> d;
+    ds::BufferSink sink(pout);
+    int r, upto = 0;
+
+    if ((r = d.init(pin, lin, lout)) < 0)
+        return r;
+    do {
+        upto += step;
+        r = d.run(sink, upto);
+    } while (r >= 0 && d.s.state == DS_ST_DATA);
+    return r;
+}
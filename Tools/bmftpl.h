@@ -0,0 +1,31 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmftpl.h
+//  YogaSMC host tools
+//
+
+#ifndef bmftpl_h
+#define bmftpl_h
+
+#include "../YogaSMC/bmfdec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ds::BufferSink, same result as ds_dec with flg 0
+int tpl_dec(void *pin, int lin, void *pout, int lout);
+// ds::CountSink, same result as ds_probe with flg 0
+int tpl_count(void *pin, int lin, int lout, ds_count_t *cnt);
+// ds::HashSink, 64-bit FNV-1a of the output in *hash
+int tpl_hash(void *pin, int lin, void *pout, int lout, uint64_t *hash);
+// ds::FeedSink, checksum of the fed blocks in *sum
+int tpl_feed(void *pin, int lin, void *pout, int lout, uint32_t *sum);
+// ds::Decoder resumed every step output bytes, same result as tpl_dec
+int tpl_upto(void *pin, int lin, void *pout, int lout, int step);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* bmftpl_h */
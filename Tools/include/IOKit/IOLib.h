@@ -0,0 +1,24 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  IOLib.h
+//  YogaSMC host tools
+//
+//  Minimal stand-in for <IOKit/IOLib.h> so that the kext sources build
+//  as ordinary user space code.
+//
+
+#ifndef IOLib_h
+#define IOLib_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IOLog(...) fprintf(stderr, __VA_ARGS__)
+#define IOMalloc(size) malloc(size)
+#define IOFree(p, size) free(p)
+
+#define APPLE_KEXT_OVERRIDE override
+
+#endif /* IOLib_h */
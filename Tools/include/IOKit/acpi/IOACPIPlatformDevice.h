@@ -0,0 +1,310 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  IOACPIPlatformDevice.h
+//  YogaSMC host tools
+//
+//  Minimal stand-ins for the libkern containers used by the MOF parser,
+//  so that bmfparser.cpp builds as ordinary user space code. Only the
+//  calls the parser makes are provided, without OSMetaClass or RTTI.
+//
+
+#ifndef IOACPIPlatformDevice_h
+#define IOACPIPlatformDevice_h
+
+#include <IOKit/IOLib.h>
+#include <strings.h>
+#include <atomic>
+
+class OSObject {
+public:
+    enum {kObject, kString, kNumber, kBoolean, kData, kArray, kDictionary};
+
+    virtual void retain() const {refs++;};
+    virtual void release() const {if (--refs == 0) delete this;};
+    virtual int getKind() const {return kObject;};
+
+    // Objects alive in this process, for leak checks, from any thread
+    static std::atomic<long> &liveCount() {static std::atomic<long> live; return live;};
+
+protected:
+    OSObject() {liveCount()++;};
+    virtual ~OSObject() {liveCount()--;};
+
+private:
+    // not atomic, an object is used by one thread at a time
+    mutable int refs {1};
+};
+
+template <class T> static inline T *OSDynamicCastTo(const OSObject *o) {
+    return o && o->getKind() == T::kKind ? (T *)o : nullptr;
+}
+
+#define OSDynamicCast(type, inst) OSDynamicCastTo<type>(inst)
+#define OSSafeReleaseNULL(inst) do { if (inst) (inst)->release(); (inst) = nullptr; } while (0)
+
+class OSString : public OSObject {
+public:
+    enum {kKind = kString};
+    static OSString *withCString(const char *cString) {
+        OSString *me = new OSString;
+        me->init(cString);
+        return me;
+    };
+    const char *getCStringNoCopy() const {return str;};
+    unsigned getLength() const {return len;};
+    bool isEqualTo(const char *cString) const {return strcmp(str, cString) == 0;};
+    bool isSymbol() const {return symbol;};
+    int getKind() const override {return kKind;};
+protected:
+    ~OSString() override {free(str);};
+    void init(const char *cString) {
+        len = (unsigned)strlen(cString);
+        str = (char *)malloc(len + 1);
+        memcpy(str, cString, len + 1);
+    };
+    bool symbol {false};
+private:
+    char *str;
+    unsigned len;
+};
+
+// Not pooled, every call makes a new symbol
+class OSSymbol : public OSString {
+public:
+    static const OSSymbol *withCString(const char *cString) {
+        OSSymbol *me = new OSSymbol;
+        me->init(cString);
+        me->symbol = true;
+        return me;
+    };
+};
+
+// Strings made by OSSymbol::withCString, as the libkern cast tells them apart
+template <> inline OSSymbol *OSDynamicCastTo<OSSymbol>(const OSObject *o) {
+    return o && o->getKind() == OSObject::kString && ((const OSString *)o)->isSymbol() ? (OSSymbol *)o : nullptr;
+}
+
+class OSNumber : public OSObject {
+public:
+    enum {kKind = kNumber};
+    static OSNumber *withNumber(unsigned long long value, unsigned bits) {
+        OSNumber *me = new OSNumber;
+        me->bits = bits;
+        me->value = bits < 64 ? value & ((1ULL << bits) - 1) : value;
+        return me;
+    };
+    unsigned long long unsigned64BitValue() const {return value;};
+    unsigned int unsigned32BitValue() const {return (unsigned int)value;};
+    unsigned numberOfBits() const {return bits;};
+    int getKind() const override {return kKind;};
+private:
+    unsigned long long value;
+    unsigned bits;
+};
+
+class OSBoolean : public OSObject {
+public:
+    enum {kKind = kBoolean};
+    static OSBoolean *withBoolean(bool value) {
+        static OSBoolean t(true), f(false);
+        return value ? &t : &f;
+    };
+    bool isTrue() const {return value;};
+    int getKind() const override {return kKind;};
+    // shared and never freed, like the libkern constants
+    void retain() const override {};
+    void release() const override {};
+private:
+    OSBoolean(bool value) {this->value = value; liveCount()--;};
+    ~OSBoolean() override {liveCount()++;};
+    bool value;
+};
+
+#define kOSBooleanTrue OSBoolean::withBoolean(true)
+#define kOSBooleanFalse OSBoolean::withBoolean(false)
+
+class OSData : public OSObject {
+public:
+    enum {kKind = kData};
+    static OSData *withBytes(const void *bytes, unsigned numBytes) {
+        OSData *me = new OSData;
+        me->len = numBytes;
+        me->data = malloc(numBytes ? numBytes : 1);
+        memcpy(me->data, bytes, numBytes);
+        return me;
+    };
+    const void *getBytesNoCopy() const {return data;};
+    unsigned getLength() const {return len;};
+    int getKind() const override {return kKind;};
+protected:
+    ~OSData() override {free(data);};
+private:
+    void *data;
+    unsigned len;
+};
+
+class OSArray : public OSObject {
+public:
+    enum {kKind = kArray};
+    static OSArray *withCapacity(unsigned capacity) {
+        OSArray *me = new OSArray;
+        me->grow(capacity);
+        return me;
+    };
+    bool setObject(const OSObject *anObject) {return setObject(count, anObject);};
+    // inserts at index, like the libkern version
+    bool setObject(unsigned index, const OSObject *anObject) {
+        if (!anObject || index > count || !grow(count + 1))
+            return false;
+        memmove(array + index + 1, array + index, (count - index) * sizeof(*array));
+        anObject->retain();
+        array[index] = anObject;
+        count++;
+        return true;
+    };
+    OSObject *getObject(unsigned index) const {return index < count ? (OSObject *)array[index] : nullptr;};
+    unsigned getCount() const {return count;};
+    void flushCollection() {
+        while (count)
+            array[--count]->release();
+    };
+    int getKind() const override {return kKind;};
+protected:
+    ~OSArray() override {flushCollection(); free(array);};
+private:
+    bool grow(unsigned n) {
+        if (n <= capacity)
+            return true;
+        n = n < 2 * capacity ? 2 * capacity : n;
+        const OSObject **p = (const OSObject **)realloc(array, n * sizeof(*array));
+        if (!p)
+            return false;
+        array = p;
+        capacity = n;
+        return true;
+    };
+    const OSObject **array {nullptr};
+    unsigned count {0};
+    unsigned capacity {0};
+};
+
+// Keys keep their insertion order, getKey and getValue walk them
+class OSDictionary : public OSObject {
+public:
+    enum {kKind = kDictionary};
+    static OSDictionary *withCapacity(unsigned capacity) {
+        OSDictionary *me = new OSDictionary;
+        me->grow(capacity);
+        return me;
+    };
+    bool setObject(const char *aKey, const OSObject *anObject) {
+        if (!aKey || !anObject)
+            return false;
+        int i = find(aKey);
+        anObject->retain();
+        if (i >= 0) {
+            values[i]->release();
+            values[i] = anObject;
+            return true;
+        }
+        if (!grow(count + 1)) {
+            anObject->release();
+            return false;
+        }
+        keys[count] = OSSymbol::withCString(aKey);
+        values[count++] = anObject;
+        return true;
+    };
+    // Symbols are kept as the key, like the libkern version
+    bool setObject(const OSString *aKey, const OSObject *anObject) {
+        if (!aKey || !aKey->isSymbol())
+            return aKey && setObject(aKey->getCStringNoCopy(), anObject);
+        if (!anObject || find(aKey->getCStringNoCopy()) >= 0 || !grow(count + 1))
+            return setObject(aKey->getCStringNoCopy(), anObject);
+        aKey->retain();
+        anObject->retain();
+        keys[count] = aKey;
+        values[count++] = anObject;
+        return true;
+    };
+    OSObject *getObject(const char *aKey) const {
+        int i = find(aKey);
+        return i < 0 ? nullptr : (OSObject *)values[i];
+    };
+    OSObject *getObject(const OSString *aKey) const {return aKey ? getObject(aKey->getCStringNoCopy()) : nullptr;};
+    void removeObject(const char *aKey) {
+        int i = find(aKey);
+        if (i < 0)
+            return;
+        keys[i]->release();
+        values[i]->release();
+        count--;
+        memmove(keys + i, keys + i + 1, (count - i) * sizeof(*keys));
+        memmove(values + i, values + i + 1, (count - i) * sizeof(*values));
+    };
+    bool merge(const OSDictionary *other) {
+        if (!other)
+            return false;
+        for (unsigned i = 0; i < other->count; i++)
+            setObject(other->keys[i], other->values[i]);
+        return true;
+    };
+    unsigned getCount() const {return count;};
+    const OSString *getKey(unsigned index) const {return index < count ? keys[index] : nullptr;};
+    OSObject *getValue(unsigned index) const {return index < count ? (OSObject *)values[index] : nullptr;};
+    void flushCollection() {
+        while (count) {
+            count--;
+            keys[count]->release();
+            values[count]->release();
+        }
+    };
+    int getKind() const override {return kKind;};
+protected:
+    ~OSDictionary() override {flushCollection(); free(keys); free(values);};
+private:
+    int find(const char *aKey) const {
+        for (unsigned i = 0; i < count; i++)
+            if (keys[i]->isEqualTo(aKey))
+                return (int)i;
+        return -1;
+    };
+    bool grow(unsigned n) {
+        if (n <= capacity)
+            return true;
+        n = n < 2 * capacity ? 2 * capacity : n;
+        const OSString **k = (const OSString **)realloc(keys, n * sizeof(*keys));
+        if (k)
+            keys = k;
+        const OSObject **v = (const OSObject **)realloc(values, n * sizeof(*values));
+        if (v)
+            values = v;
+        if (!k || !v)
+            return false;
+        capacity = n;
+        return true;
+    };
+    const OSString **keys {nullptr};
+    const OSObject **values {nullptr};
+    unsigned count {0};
+    unsigned capacity {0};
+};
+
+// Keys of a dictionary in the order they were set
+class OSCollectionIterator : public OSObject {
+public:
+    static OSCollectionIterator *withCollection(const OSDictionary *dict) {
+        OSCollectionIterator *me = new OSCollectionIterator;
+        dict->retain();
+        me->dict = dict;
+        return me;
+    };
+    OSObject *getNextObject() {return (OSObject *)dict->getKey(index++);};
+protected:
+    ~OSCollectionIterator() override {dict->release();};
+private:
+    const OSDictionary *dict {nullptr};
+    unsigned index {0};
+};
+
+#endif /* IOACPIPlatformDevice_h */
@@ -0,0 +1,102 @@
+/*
+    mkbmf.c - Wrap raw MOF data into a BMF blob
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../YogaSMC/bmfdec.h"
+#include "bmfenc.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mkbmf [-r repeat] [-c] input.mof output.bmf\n"
+                    "  -r  concatenate the input repeat times (synthetic corpora)\n"
+                    "  -c  decompress the result again with ds_dec and compare\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    long repeat = 1, size, i;
+    int check = 0, opt, len, ret;
+    char *raw, *bmf, *out;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "r:c")) != -1) {
+        switch (opt) {
+            case 'r':
+                repeat = strtol(optarg, NULL, 0);
+                break;
+            case 'c':
+                check = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 2 || repeat < 1)
+        usage();
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0 || size * repeat > 0x7fffffff - BMF_ENC_BOUND(0x10000000L)) {
+        fprintf(stderr, "Invalid input size %ld\n", size);
+        return 1;
+    }
+    raw = malloc(size * repeat);
+    if (!raw || fread(raw, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", argv[optind]);
+        return 1;
+    }
+    fclose(f);
+    for (i = 1; i < repeat; i++)
+        memcpy(raw + i * size, raw, size);
+    size *= repeat;
+
+    bmf = malloc(BMF_ENC_BOUND(size));
+    len = bmf ? bmf_enc(raw, (int)size, bmf, (int)BMF_ENC_BOUND(size)) : -1;
+    if (len < 0) {
+        fprintf(stderr, "Compress failed\n");
+        return 1;
+    }
+
+    if (check) {
+        out = malloc(size);
+        ret = out ? ds_dec(bmf + 16, len - 16, out, (int)size, 0) : -1;
+        if (ret != size || memcmp(out, raw, size)) {
+            fprintf(stderr, "Round trip failed: %d\n", ret);
+            return 1;
+        }
+        free(out);
+    }
+
+    f = fopen(argv[optind + 1], "wb");
+    if (!f || fwrite(bmf, 1, len, f) != (size_t)len || fclose(f)) {
+        fprintf(stderr, "Failed to write %s\n", argv[optind + 1]);
+        return 1;
+    }
+    printf("%ld -> %d bytes\n", size, len);
+    free(bmf);
+    free(raw);
+    return 0;
+}
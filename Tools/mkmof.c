@@ -0,0 +1,380 @@
+/*
+    mkmof.c - Generate synthetic binary MOF data for the host checks
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+/*
+ * Writes the decompressed part of a BMF, to be wrapped by mkbmf. Class i
+ * is Lenovo_Class<i> with guid ABCD<i>-D566-11D1-B2F0-00A0C906<i> (in
+ * braces for odd i) and covers what the parser handles: qualifiers of
+ * most types, objects with ValueMap/Values, signed and unsigned values of
+ * every width and, for even i, a method with parameter classes. The
+ * footer points at the qualifiers named in flavors[]. Nothing is random,
+ * the same arguments always give the same file.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+    T_SINT16 = 0x02,
+    T_SINT32 = 0x03,
+    T_STRING = 0x08,
+    T_BOOLEAN = 0x0B,
+    T_OBJECT = 0x0D,
+    T_UINT8 = 0x11,
+    T_UINT32 = 0x13,
+    T_SINT64 = 0x14,
+};
+
+// Growable output, every record is built in one and copied into its parent
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+    uint32_t cap;
+} buf_t;
+
+static void put(buf_t *b, const void *data, uint32_t len)
+{
+    if (b->len + len > b->cap) {
+        b->cap = (b->len + len) * 2;
+        b->data = realloc(b->data, b->cap);
+        if (!b->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    if (len)
+        memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+// unaligned little endian word of b at offset
+static uint32_t get32(const buf_t *b, uint32_t offset)
+{
+    uint32_t v;
+
+    memcpy(&v, b->data + offset, 4);
+    return v;
+}
+
+static void put32(buf_t *b, uint32_t v)
+{
+    uint8_t le[4] = {v, v >> 8, v >> 16, v >> 24};
+    put(b, le, 4);
+}
+
+static void put16(buf_t *b, uint16_t v)
+{
+    uint8_t le[2] = {v, v >> 8};
+    put(b, le, 2);
+}
+
+// Record header shared by items, objects and methods
+static void head(buf_t *b, uint32_t length, uint8_t type, uint8_t flags, uint32_t a, uint32_t c)
+{
+    put32(b, length);
+    put(b, &type, 1);
+    put(b, &flags, 1);
+    put16(b, 0);
+    put32(b, 0);
+    put32(b, a);
+    put32(b, c);
+}
+
+static void move(buf_t *to, buf_t *from)
+{
+    put(to, from->data, from->len);
+    free(from->data);
+    memset(from, 0, sizeof(*from));
+}
+
+// NUL terminated UTF-16LE of a UTF-8 string, BMP only
+static void utf16(buf_t *b, const char *s)
+{
+    const uint8_t *p = (const uint8_t *)s;
+    uint16_t c;
+
+    while (*p) {
+        if (*p < 0x80)
+            c = *p++;
+        else if (*p < 0xE0) {
+            c = (p[0] & 0x1F) << 6 | (p[1] & 0x3F);
+            p += 2;
+        } else {
+            c = (p[0] & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F);
+            p += 3;
+        }
+        put16(b, c);
+    }
+    put16(b, 0);
+}
+
+static void item(buf_t *out, const char *name, uint8_t type, int64_t v, const char *s)
+{
+    buf_t n = {0}, val = {0};
+
+    utf16(&n, name);
+    switch (type) {
+        case T_STRING:
+            utf16(&val, s);
+            break;
+        case T_BOOLEAN:
+            put16(&val, v ? 0xFFFF : 0);
+            break;
+        case T_UINT8:
+            put(&val, &v, 1);
+            break;
+        case T_SINT16:
+            put16(&val, (uint16_t)v);
+            break;
+        case T_SINT32:
+        case T_UINT32:
+            put32(&val, (uint32_t)v);
+            break;
+        case T_SINT64:
+            put32(&val, (uint32_t)v);
+            put32(&val, (uint32_t)(v >> 32));
+            break;
+    }
+    head(out, 0x14 + n.len + val.len, type, 0, n.len, 0xFFFFFFFF);
+    move(out, &n);
+    move(out, &val);
+}
+
+// Array qualifier of strings, or of integers when ints is set
+static void array(buf_t *out, const char *name, uint8_t type, const char *const *strs, const int32_t *ints, uint32_t count)
+{
+    buf_t n = {0}, el = {0};
+    uint32_t i;
+
+    utf16(&n, name);
+    for (i = 0; i < count; i++)
+        if (ints)
+            put32(&el, (uint32_t)ints[i]);
+        else
+            utf16(&el, strs[i]);
+    head(out, 0x14 + n.len + 0x10 + el.len, type, 0x20, n.len, 0xFFFFFFFF);
+    move(out, &n);
+    put32(out, 0x10 + el.len);
+    put32(out, 1);
+    put32(out, count);
+    put32(out, 0x10 + el.len - 0xc);
+    move(out, &el);
+}
+
+static void block(buf_t *out, buf_t *items, uint32_t count)
+{
+    put32(out, 8 + items->len);
+    put32(out, count);
+    move(out, items);
+}
+
+static void object(buf_t *out, const char *name, uint8_t type, buf_t *quals, uint32_t nquals)
+{
+    buf_t n = {0};
+
+    utf16(&n, name);
+    head(out, 0x14 + n.len + 8 + quals->len, type, 0, 0xFFFFFFFF, n.len);
+    move(out, &n);
+    block(out, quals, nquals);
+}
+
+// Class record, parameter classes have no qualifier block
+static void cls(buf_t *out, buf_t *quals, uint32_t nquals, buf_t *vars, uint32_t nvars,
+                buf_t *methods, uint32_t nmethods, int param)
+{
+    buf_t body = {0};
+
+    if (!param)
+        block(&body, quals, nquals);
+    block(&body, vars, nvars);
+    block(&body, methods, nmethods);
+    put32(out, 0x14 + body.len);
+    put32(out, param ? 0xFFFFFFFF : 0);
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, param ? 1 : 0);
+    move(out, &body);
+}
+
+static void method(buf_t *out, const char *name, buf_t *params, uint32_t nparams, buf_t *quals, uint32_t nquals)
+{
+    buf_t n = {0}, q = {0};
+
+    utf16(&n, name);
+    block(&q, quals, nquals);
+    head(out, 0x14 + n.len + 0x10 + params->len + q.len, T_OBJECT, 0x20, n.len, 0);
+    move(out, &n);
+    put32(out, 0x10 + params->len);
+    put32(out, 1);
+    put32(out, nparams);
+    put32(out, 0);
+    move(out, params);
+    move(out, &q);
+}
+
+static void mkclass(buf_t *out, int i)
+{
+    static const char *const map[] = {"0", "1", "2"};
+    static const char *const values[] = {"Off", "On", "Auto"};
+    static const char *const levels[] = {"Neg", "Zero", "Five"};
+    static const int32_t levelmap[] = {-1, 0, 5};
+    buf_t quals = {0}, vars = {0}, methods = {0}, q = {0}, v = {0}, params = {0};
+    uint32_t nquals = 3, nmethods = 0;
+    char str[64];
+
+    item(&quals, "WMI", T_BOOLEAN, 1, NULL);
+    snprintf(str, sizeof(str), i % 2 ? "{%08X-D566-11D1-B2F0-00A0C906%04X}" : "%08X-D566-11D1-B2F0-00A0C906%04X",
+             0xABCD0000 + i, i);
+    item(&quals, "guid", T_STRING, 0, str);
+    snprintf(str, sizeof(str), "Class number %d \xc3\xa9\xe4\xb8\xad", i);
+    item(&quals, "Description", T_STRING, 0, str);
+    if (i % 3 == 0) {
+        item(&quals, "Dynamic", T_BOOLEAN, 1, NULL);
+        nquals++;
+    }
+    if (i % 4 == 1) {
+        item(&quals, "locale", T_SINT32, -1033 + i, NULL);
+        nquals++;
+    }
+
+    snprintf(str, sizeof(str), "Lenovo_Class%d", i);
+    item(&vars, "__CLASS", T_STRING, 0, str);
+    item(&vars, "__NAMESPACE", T_STRING, 0, "ROOT\\WMI");
+    item(&q, "key", T_BOOLEAN, 1, NULL);
+    item(&q, "read", T_BOOLEAN, 1, NULL);
+    item(&q, "CIMTYPE", T_STRING, 0, "string");
+    object(&vars, "InstanceName", T_STRING, &q, 3);
+    item(&q, "read", T_BOOLEAN, 1, NULL);
+    item(&q, "CIMTYPE", T_STRING, 0, "boolean");
+    object(&vars, "Active", T_BOOLEAN, &q, 2);
+    item(&q, "WmiDataId", T_SINT32, 1, NULL);
+    item(&q, "read", T_BOOLEAN, 1, NULL);
+    item(&q, "CIMTYPE", T_STRING, 0, "sint32");
+    array(&q, "ValueMap", T_STRING, map, NULL, 3);
+    array(&q, "Values", T_STRING, values, NULL, 3);
+    object(&vars, "Data", T_SINT32, &q, 5);
+    item(&q, "WmiDataId", T_SINT32, 2, NULL);
+    array(&q, "ValueMap", T_SINT32, NULL, levelmap, 3);
+    array(&q, "Values", T_STRING, levels, NULL, 3);
+    object(&vars, "Level", T_SINT32, &q, 3);
+    item(&vars, "Counter", T_UINT8, 200, NULL);
+    item(&vars, "Big", T_SINT64, -5, NULL);
+    item(&vars, "Small", T_SINT16, -2, NULL);
+    item(&vars, "U32", T_UINT32, 0xFFFFFFF0, NULL);
+
+    if (i % 2 == 0) {
+        item(&v, "__CLASS", T_STRING, 0, "__PARAMETERS");
+        item(&q, "ID", T_SINT32, 0, NULL);
+        item(&q, "in", T_BOOLEAN, 1, NULL);
+        item(&q, "CIMTYPE", T_STRING, 0, "string");
+        object(&v, "Data", T_STRING, &q, 3);
+        cls(&params, &q, 0, &v, 2, &methods, 0, 1);
+        if (i % 4 == 0) {
+            item(&q, "ID", T_SINT32, 0, NULL);
+            item(&q, "out", T_BOOLEAN, 1, NULL);
+            object(&v, "Return", T_STRING, &q, 2);
+            cls(&params, &q, 0, &v, 1, &methods, 0, 1);
+        }
+        item(&q, "WmiMethodId", T_SINT32, i + 1, NULL);
+        item(&q, "Implemented", T_BOOLEAN, 1, NULL);
+        snprintf(str, sizeof(str), "GetData%d", i);
+        method(&methods, str, &params, i % 4 == 0 ? 2 : 1, &q, 2);
+        nmethods = 1;
+    }
+    cls(out, &quals, nquals, &vars, 10, &methods, nmethods, 0);
+}
+
+// Qualifier names the footer points at, and their flavor types
+static const struct {
+    const char *name;
+    uint32_t type;
+} flavors[] = {
+    {"Dynamic", 1}, {"CIMTYPE", 3}, {"ID", 0x11}, {"WMI", 2},
+    {"Description", 3}, {"WmiDataId", 0x11}, {"read", 1},
+};
+
+static void footer(buf_t *mof)
+{
+    buf_t offsets = {0}, n = {0};
+    uint32_t count = 0, f, k, rec;
+
+    for (f = 0; f < sizeof(flavors) / sizeof(flavors[0]); f++) {
+        utf16(&n, flavors[f].name);
+        // an item record whose name is this one
+        for (k = 0x14; k + n.len <= mof->len && count < 0x1ff; k++) {
+            if (memcmp(mof->data + k, n.data, n.len))
+                continue;
+            rec = k - 0x14;
+            if (get32(mof, rec + 12) == n.len && get32(mof, rec + 16) == 0xFFFFFFFF) {
+                put32(&offsets, rec);
+                put32(&offsets, flavors[f].type);
+                count++;
+            }
+        }
+        free(n.data);
+        memset(&n, 0, sizeof(n));
+    }
+    put(mof, "BMOFQUALFLAVOR11", 16);
+    put32(mof, count);
+    move(mof, &offsets);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mkmof [-n classes] output.mof\n"
+                    "  -n  number of classes, 1 to 255 (default 12)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    buf_t mof = {0};
+    long classes = 12;
+    int opt, i;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                classes = strtol(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 1 || classes < 1 || classes > 0xff)
+        usage();
+
+    put32(&mof, 0x424D4F46);
+    put32(&mof, 0);
+    put32(&mof, 1);
+    put32(&mof, 1);
+    put32(&mof, (uint32_t)classes);
+    for (i = 0; i < classes; i++)
+        mkclass(&mof, i);
+    footer(&mof);
+    memcpy(mof.data + 4, &mof.len, 4);
+
+    f = fopen(argv[optind], "wb");
+    if (!f || fwrite(mof.data, 1, mof.len, f) != mof.len || fclose(f)) {
+        fprintf(stderr, "Failed to write %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    free(mof.data);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/*
+    mofcache.cpp - Cold and warm start of WMI with a schema cache in files
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../YogaSMC/bmfparser.hpp"
+#include "../YogaSMC/bmfcache.hpp"
+
+#define BMF_GUID "05901221-d566-11d1-b2f0-00a0c9062910"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mofcache [-n loops] [-d dir] [-c] input.bmf...\n"
+                    "  input  .bmf file or raw WQxx buffer dump\n"
+                    "  -n  starts of each kind, the average is reported, default 100\n"
+                    "  -d  cache directory, one file per BMF hash, default /tmp\n"
+                    "  -c  check the cached names and methods against the MOF\n");
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A file per key in dir, replaced by rename so a reader never sees half of one
+class MOFFileStore : public MOFCacheStore {
+
+public:
+    MOFFileStore(const char *dir) {this->dir = dir;};
+
+    virtual OSData* load(uint64_t key) APPLE_KEXT_OVERRIDE;
+    virtual bool store(uint64_t key, OSData *data) APPLE_KEXT_OVERRIDE;
+
+private:
+    void path(char *out, size_t size, uint64_t key, const char *suffix);
+
+    const char *dir;
+};
+
+void MOFFileStore::path(char *out, size_t size, uint64_t key, const char *suffix)
+{
+    snprintf(out, size, "%s/%016llx.mofs%s", dir, (unsigned long long)key, suffix);
+}
+
+OSData* MOFFileStore::load(uint64_t key)
+{
+    char name[4096];
+    OSData *data = nullptr;
+    char *buf;
+    long size;
+    FILE *f;
+
+    path(name, sizeof(name), key, "");
+    f = fopen(name, "rb");
+    if (!f)
+        return nullptr;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = size > 0 && size < 0x1000000 ? (char *)malloc(size) : nullptr;
+    if (buf && fread(buf, 1, size, f) == (size_t)size)
+        data = OSData::withBytes(buf, (unsigned)size);
+    free(buf);
+    fclose(f);
+    return data;
+}
+
+bool MOFFileStore::store(uint64_t key, OSData *data)
+{
+    char name[4096], tmp[4096];
+    bool ok;
+    FILE *f;
+
+    path(name, sizeof(name), key, "");
+    path(tmp, sizeof(tmp), key, ".tmp");
+    f = fopen(tmp, "wb");
+    if (!f)
+        return false;
+    ok = fwrite(data->getBytesNoCopy(), 1, data->getLength(), f) == data->getLength();
+    ok = !fclose(f) && ok && !rename(tmp, name);
+    if (!ok)
+        unlink(tmp);
+    return ok;
+}
+
+struct timing {
+    double hash;
+    double parse;       // probe, decompress and index, as WMI::parseBMF
+    double compile;
+    double store;
+    double load;        // read and check the stored schema
+};
+
+// First start, what WMI::extractBMF does without a schema, false on error
+static bool cold(MOFCacheStore *cache, const char *raw, uint32_t size, timing *t)
+{
+    OSDictionary *mData = OSDictionary::withCapacity(1);
+    OSDictionary *entry = OSDictionary::withCapacity(1);
+    MOFSchemaBuilder builder;
+    uint32_t len = ((uint32_t *)raw)[3];
+    char *mof = (char *)malloc(len ? len : 1);
+    OSData *data = nullptr;
+    bool ok = false;
+    uint64_t key;
+    double t0;
+
+    mData->setObject(BMF_GUID, entry);
+    entry->release();
+
+    t0 = now();
+    key = mof_hash(raw, size);
+    t->hash += now() - t0;
+
+    t0 = now();
+    MOF *parser = new MOF(mof, len, mData);
+    if (mof && ds_probe((char *)raw + 16, (int)size - 16, (int)len, 0, nullptr) == (int)len &&
+        ds_dec((char *)raw + 16, (int)size - 16, mof, (int)len, 0) == (int)len &&
+        parser->index_bmf((char *)BMF_GUID)) {
+        t->parse += now() - t0;
+
+        t0 = now();
+        for (uint32_t i = 0; i < parser->getClassCount(); i++)
+            if (!builder.add(parser, i, -1))
+                break;
+        data = builder.finish(key, size);
+        t->compile += now() - t0;
+
+        t0 = now();
+        ok = data && cache->store(key, data);
+        t->store += now() - t0;
+    }
+    delete parser;
+    OSSafeReleaseNULL(data);
+    mData->release();
+    free(mof);
+    return ok;
+}
+
+// Later start, the schema instead of ds_dec and the index
+static MOFSchema *warm(MOFCacheStore *cache, const char *raw, uint32_t size, timing *t)
+{
+    MOFSchema *schema;
+    OSData *data;
+    uint64_t key;
+    double t0;
+
+    t0 = now();
+    key = mof_hash(raw, size);
+    t->hash += now() - t0;
+
+    t0 = now();
+    data = cache->load(key);
+    schema = MOFSchema::withData(data, key, size);
+    OSSafeReleaseNULL(data);
+    t->load += now() - t0;
+    return schema;
+}
+
+// Names as WMI::getMOFName streams them, methods as the parser has them
+static uint32_t check(MOFSchema *schema, const char *raw, uint32_t size)
+{
+    OSDictionary *mData = OSDictionary::withCapacity(1);
+    OSDictionary *entry = OSDictionary::withCapacity(1);
+    uint32_t len = ((uint32_t *)raw)[3], bad = 0, n = 0, vlen;
+    char *mof = (char *)malloc(len ? len : 1);
+    char name[256];
+    MOF *parser;
+
+    mData->setObject(BMF_GUID, entry);
+    entry->release();
+    if (!mof || ds_dec((char *)raw + 16, (int)size - 16, mof, (int)len, 0) != (int)len) {
+        free(mof);
+        mData->release();
+        return 1;
+    }
+    parser = new MOF(mof, len, mData);
+    if (!parser->index_bmf((char *)BMF_GUID))
+        bad++;
+    for (uint32_t i = 0; i < parser->getClassCount(); i++) {
+        const char *guid = parser->getClassGUID(i);
+        if (!guid[0])
+            continue;
+        // a GUID on two classes is looked up as the first one
+        const mof_schema_class *cls = schema->getClassAt(n++);
+        if (cls != schema->getClass(guid))
+            continue;
+        MOFStringVisitor visitor("__CLASS", MOF_ROLE_VARIABLE, name, sizeof(name));
+        parser->visitClassAt(i, &visitor);
+        if (!cls || !visitor.found(&vlen) != !cls->name ||
+            (cls->name && strcmp(name, schema->getString(cls->name)))) {
+            fprintf(stderr, "class %u %s: name mismatch\n", i, guid);
+            bad++;
+            continue;
+        }
+        OSDictionary *dict = parser->getClassAt(i);
+        OSDictionary *methods = dict ? OSDynamicCast(OSDictionary, dict->getObject("methods")) : nullptr;
+        uint32_t count = methods ? methods->getCount() : 0;
+        // method qualifiers are merged in there too
+        if (methods && methods->getObject("quaifiers"))
+            count--;
+        if (count != cls->methods) {
+            fprintf(stderr, "class %u %s: %u methods, %u cached\n", i, guid, count, cls->methods);
+            bad++;
+        }
+    }
+    if (n != schema->getClassCount()) {
+        fprintf(stderr, "%u classes with a GUID, %u cached\n", n, schema->getClassCount());
+        bad++;
+    }
+    delete parser;
+    mData->release();
+    free(mof);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = "/tmp";
+    long loops = 100, size;
+    int checking = 0, opt, ret = 0;
+    uint32_t *hdr;
+    char *raw;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "n:d:c")) != -1) {
+        switch (opt) {
+            case 'n':
+                loops = strtol(optarg, NULL, 0);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'c':
+                checking = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc || loops < 1)
+        usage();
+
+    MOFFileStore cache(dir);
+    for (; optind < argc; optind++) {
+        const char *path = argv[optind];
+        timing c = {}, w = {};
+        MOFSchema *schema = nullptr;
+        uint32_t bad = 0;
+        bool ok = true;
+
+        f = fopen(path, "rb");
+        if (!f) {
+            fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+            ret = 1;
+            continue;
+        }
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        raw = size > 16 && size <= 0x7fffffff ? (char *)malloc(size) : nullptr;
+        if (!raw || fread(raw, 1, size, f) != (size_t)size) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            fclose(f);
+            free(raw);
+            ret = 1;
+            continue;
+        }
+        fclose(f);
+
+        // same header check as WMI::extractBMF, only the WQxx buffer is hashed
+        hdr = (uint32_t *)raw;
+        if (hdr[0] != 0x424D4F46 || hdr[1] != 0x01 || hdr[2] != size - 16) {
+            fprintf(stderr, "%s: not a BMF\n", path);
+            free(raw);
+            ret = 1;
+            continue;
+        }
+
+        for (long i = 0; i < loops && ok; i++)
+            ok = cold(&cache, raw, (uint32_t)size, &c);
+        for (long i = 0; i < loops && ok; i++) {
+            delete schema;
+            schema = warm(&cache, raw, (uint32_t)size, &w);
+            ok = schema != nullptr;
+        }
+        if (!ok) {
+            printf("%s: %ld bytes, not cached\n", path, size);
+            delete schema;
+            free(raw);
+            ret = 1;
+            continue;
+        }
+
+        uint32_t methods = 0, params = 0;
+        for (uint32_t i = 0; i < schema->getClassCount(); i++) {
+            const mof_schema_class *cls = schema->getClassAt(i);
+            methods += cls->methods;
+            for (uint32_t j = 0; j < cls->methods; j++)
+                params += schema->getMethod(cls, j)->params;
+        }
+        double tc = (c.hash + c.parse + c.compile + c.store) / loops;
+        double tw = (w.hash + w.load) / loops;
+        printf("%s: %ld bytes, schema %u bytes, %u classes, %u methods, %u parameters\n",
+               path, size, schema->getSize(), schema->getClassCount(), methods, params);
+        printf("%s: cold %.1f us (hash %.1f, decompress and index %.1f, compile %.1f, store %.1f)\n",
+               path, tc * 1e6, c.hash / loops * 1e6, c.parse / loops * 1e6, c.compile / loops * 1e6,
+               c.store / loops * 1e6);
+        printf("%s: warm %.1f us (hash %.1f, load %.1f), %.1fx faster\n",
+               path, tw * 1e6, w.hash / loops * 1e6, w.load / loops * 1e6, tc / tw);
+        if (checking) {
+            bad = check(schema, raw, (uint32_t)size);
+            printf("%s: %s\n", path, bad ? "cached schema differs" : "cached schema matches");
+            if (bad)
+                ret = 1;
+        }
+        delete schema;
+        free(raw);
+    }
+    return ret;
+}
@@ -0,0 +1,718 @@
+/*
+    mofdump.cpp - Dump BMF blobs as JSON or MOF text, many at a time
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "../YogaSMC/bmfparser.hpp"
+
+#define BMF_GUID "05901221-d566-11d1-b2f0-00a0c9062910"
+#define MAX_THREADS 256
+
+enum {FORMAT_JSON, FORMAT_MOF};
+
+enum {
+    DUMP_OK,
+    DUMP_PARSE_ERROR,   // dumped as far as it parsed
+    DUMP_INVALID,       // not a BMF or MOF buffer
+    DUMP_IO_ERROR,
+};
+
+static const char *states[] = {"ok", "parse error", "format invalid", "io error"};
+
+// One input, filled in by the worker that took it
+struct job {
+    char *path;
+    uint32_t size;          // input bytes
+    uint32_t len;           // decompressed bytes
+    uint32_t classes;
+    double decode;
+    double parse;
+    int state;
+};
+
+struct pool {
+    job *jobs;
+    uint32_t count;
+    std::atomic<uint32_t> next;
+    int format;
+    const char *outdir;     // nullptr for stdout or no output
+    bool print;             // single input without -o, dump to stdout
+};
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mofdump [-f json|mof] [-j threads] [-o dir] input...\n"
+                    "  input  .bmf file, raw WQxx buffer dump or decompressed MOF,\n"
+                    "         a directory is read for its regular files\n"
+                    "  -f  output format, json is the \"MOF\" property of a DEBUG build,\n"
+                    "      mof is MOF source, default json\n"
+                    "  -j  workers, default one per core\n"
+                    "  -o  write input.json or input.mof for each input into dir, without\n"
+                    "      it a single input is dumped to stdout, more are only timed\n");
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        switch (*s) {
+            case '"':
+                fputs("\\\"", out);
+                break;
+            case '\\':
+                fputs("\\\\", out);
+                break;
+            case '\n':
+                fputs("\\n", out);
+                break;
+            default:
+                if ((unsigned char)*s < 0x20)
+                    fprintf(out, "\\u%04x", *s);
+                else
+                    fputc(*s, out);
+                break;
+        }
+    }
+    fputc('"', out);
+}
+
+// 64 bit numbers are the sign extended SINT types, see MOF::parse_value
+static void json(FILE *out, const OSObject *o, int depth)
+{
+    switch (o ? o->getKind() : OSObject::kObject) {
+        case OSObject::kString:
+            json_string(out, OSDynamicCast(OSString, o)->getCStringNoCopy());
+            break;
+        case OSObject::kNumber: {
+            OSNumber *n = OSDynamicCast(OSNumber, o);
+            if (n->numberOfBits() == 64)
+                fprintf(out, "%lld", (long long)n->unsigned64BitValue());
+            else
+                fprintf(out, "%llu", n->unsigned64BitValue());
+            break;
+        }
+        case OSObject::kBoolean:
+            fputs(OSDynamicCast(OSBoolean, o)->isTrue() ? "true" : "false", out);
+            break;
+        case OSObject::kData: {
+            OSData *d = OSDynamicCast(OSData, o);
+            fputc('"', out);
+            for (unsigned i = 0; i < d->getLength(); i++)
+                fprintf(out, "%02x", ((const uint8_t *)d->getBytesNoCopy())[i]);
+            fputc('"', out);
+            break;
+        }
+        case OSObject::kArray: {
+            OSArray *a = OSDynamicCast(OSArray, o);
+            fputc('[', out);
+            for (unsigned i = 0; i < a->getCount(); i++) {
+                fprintf(out, "%s\n%*s", i ? "," : "", 2 * depth + 2, "");
+                json(out, a->getObject(i), depth + 1);
+            }
+            fprintf(out, a->getCount() ? "\n%*s]" : "]", 2 * depth, "");
+            break;
+        }
+        case OSObject::kDictionary: {
+            OSDictionary *d = OSDynamicCast(OSDictionary, o);
+            fputc('{', out);
+            for (unsigned i = 0; i < d->getCount(); i++) {
+                fprintf(out, "%s\n%*s", i ? "," : "", 2 * depth + 2, "");
+                json_string(out, d->getKey(i)->getCStringNoCopy());
+                fputs(": ", out);
+                json(out, d->getValue(i), depth + 1);
+            }
+            fprintf(out, d->getCount() ? "\n%*s}" : "}", 2 * depth, "");
+            break;
+        }
+        default:
+            fputs("null", out);
+            break;
+    }
+}
+
+/*
+ * MOF source from the index, without building any object. Qualifiers and
+ * properties are streamed, methods are read from the index directly since
+ * their parameters are split over an in and an out class. Flavors are not
+ * printed.
+ */
+class MOFPrinter : public MOFVisitor {
+
+public:
+    MOFPrinter(FILE *out) {this->out = out;};
+
+private:
+    virtual int beginClass(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int endClass(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int qualifier(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int property(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int method(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int endItem(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int endBlock(const mof_node *node, uint8_t role) APPLE_KEXT_OVERRIDE;
+
+    void string(const char *prefix, uint32_t offset, uint32_t len);
+    void name(const mof_node *node);
+    void type(const mof_node *node, const mof_node *cimtype);
+    void value(const mof_value *value);
+    void printQualifier(const mof_node *node);
+    void printQualifiers(const mof_node *node, bool parameter);
+    void printParameters(const mof_node *node);
+
+    FILE *out;
+    const mof_node *cls {nullptr};
+    const mof_node *item {nullptr};     // property whose qualifiers are printed
+    const mof_node *cimtype {nullptr};  // of item
+    uint32_t count {0};                 // qualifiers printed for cls or item
+    char ns[256] {};
+};
+
+// UTF-16LE span as MOF string content, escaped
+void MOFPrinter::string(const char *prefix, uint32_t offset, uint32_t len)
+{
+    char buf[1024];
+
+    source->getString(offset, len, buf, sizeof(buf));
+    fputs(prefix, out);
+    for (char *s = buf; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+}
+
+void MOFPrinter::name(const mof_node *node)
+{
+    char buf[256];
+
+    source->getString(node->name, node->nlen, buf, sizeof(buf));
+    fputs(buf, out);
+}
+
+// Type keyword, object properties take their class from CIMTYPE "object:Name"
+void MOFPrinter::type(const mof_node *node, const mof_node *cimtype)
+{
+    static const struct {
+        uint8_t type;
+        const char *name;
+    } types[] = {
+        {MOF_SINT8, "sint8"}, {MOF_UINT8, "uint8"}, {MOF_SINT16, "sint16"}, {MOF_UINT16, "uint16"},
+        {MOF_SINT32, "sint32"}, {MOF_UINT32, "uint32"}, {MOF_SINT64, "sint64"}, {MOF_UINT64, "uint64"},
+        {MOF_STRING, "string"}, {MOF_BOOLEAN, "boolean"}, {MOF_DATETIME, "datetime"}, {MOF_OBJECT, "object"},
+    };
+    char buf[256];
+
+    if (node->type == MOF_OBJECT && cimtype && cimtype->kind == MOF_NODE_VALUE &&
+        cimtype->type == MOF_STRING && !cimtype->flags) {
+        source->getString(cimtype->value.span.offset, cimtype->value.span.len, buf, sizeof(buf));
+        if (!strncmp(buf, "object:", 7)) {
+            fputs(buf + 7, out);
+            return;
+        }
+    }
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (types[i].type == node->type) {
+            fputs(types[i].name, out);
+            return;
+        }
+    }
+    fprintf(out, "type%u", node->type);
+}
+
+void MOFPrinter::value(const mof_value *value)
+{
+    switch (value->type) {
+        case MOF_STRING:
+        case MOF_DATETIME:
+            string("\"", value->span.offset, value->span.len);
+            fputc('"', out);
+            break;
+        case MOF_BOOLEAN:
+            fputs(value->uint ? "TRUE" : "FALSE", out);
+            break;
+        default:
+            if (!mof_int_size(value->type) || value->size != mof_int_size(value->type))
+                fputs("NULL", out);
+            else if (mof_int_signed(value->type))
+                fprintf(out, "%lld", (long long)value->sint);
+            else
+                fprintf(out, "%llu", (unsigned long long)value->uint);
+            break;
+    }
+}
+
+// name, name(value) or name{elements}
+void MOFPrinter::printQualifier(const mof_node *node)
+{
+    mof_value element;
+    uint32_t p;
+
+    name(node);
+    if (node->kind != MOF_NODE_VALUE)
+        return;
+    if (node->flags & MOF_NODE_ARRAY) {
+        fputc('{', out);
+        p = node->value.span.offset;
+        for (uint32_t i = 0; i < node->value.size; i++) {
+            p += source->getElement(node, p, &element);
+            fputs(i ? ", " : "", out);
+            value(&element);
+        }
+        fputc('}', out);
+    } else if (node->type != MOF_BOOLEAN || node->value.uint != 0xFFFF) {
+        fputc('(', out);
+        value(&node->value);
+        fputc(')', out);
+    }
+}
+
+// Qualifiers of a parameter or method, read from the index
+void MOFPrinter::printQualifiers(const mof_node *node, bool parameter)
+{
+    const mof_node *child;
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; (child = source->getChild(node, i)); i++) {
+        if (child->role != MOF_ROLE_QUALIFIER || (parameter && source->nameEquals(child, "CIMTYPE")))
+            continue;
+        fputs(n++ ? ", " : "[", out);
+        printQualifier(child);
+    }
+    if (n)
+        fputs("] ", out);
+}
+
+// Variables of the parameter classes, ReturnValue is the return type
+void MOFPrinter::printParameters(const mof_node *node)
+{
+    const mof_node *param, *var, *ret = nullptr;
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; (param = source->getChild(node, i)) && param->role == MOF_ROLE_PARAMETER; i++)
+        if ((var = source->findChild(param, "ReturnValue", MOF_ROLE_VARIABLE)))
+            ret = var;
+    if (ret)
+        type(ret, source->findChild(ret, "CIMTYPE", MOF_ROLE_QUALIFIER));
+    else
+        fputs("void", out);
+    fputc(' ', out);
+    name(node);
+    fputc('(', out);
+    for (uint32_t i = 0; (param = source->getChild(node, i)) && param->role == MOF_ROLE_PARAMETER; i++) {
+        for (uint32_t j = 0; (var = source->getChild(param, j)); j++) {
+            if (var->role != MOF_ROLE_VARIABLE || var == ret || var->nlen < 2 ||
+                source->read16(var->name) == '_')
+                continue;
+            fputs(n++ ? ", " : "", out);
+            printQualifiers(var, true);
+            type(var, source->findChild(var, "CIMTYPE", MOF_ROLE_QUALIFIER));
+            fputc(' ', out);
+            name(var);
+            if (var->flags & MOF_NODE_ARRAY)
+                fputs("[]", out);
+        }
+    }
+    fputs(")", out);
+}
+
+int MOFPrinter::beginClass(const mof_node *node)
+{
+    const mof_node *ns = source->findChild(node, "__NAMESPACE", MOF_ROLE_VARIABLE);
+    char buf[256] = "";
+
+    if (ns && ns->kind == MOF_NODE_VALUE && ns->type == MOF_STRING && !ns->flags)
+        source->getString(ns->value.span.offset, ns->value.span.len, buf, sizeof(buf));
+    if (buf[0] && strcmp(buf, this->ns)) {
+        strcpy(this->ns, buf);
+        fputs("#pragma namespace(\"\\\\\\\\.\\\\", out);
+        string("", ns->value.span.offset, ns->value.span.len);
+        fputs("\")\n\n", out);
+    }
+    cls = node;
+    item = nullptr;
+    count = 0;
+    return MOF_VISIT_CONTINUE;
+}
+
+int MOFPrinter::endBlock(const mof_node *node, uint8_t role)
+{
+    const mof_node *var;
+
+    if (node != cls || role != MOF_ROLE_QUALIFIER)
+        return MOF_VISIT_CONTINUE;
+    fputs(count ? "]\n" : "", out);
+    fputs("class ", out);
+    var = source->findChild(node, "__CLASS", MOF_ROLE_VARIABLE);
+    if (var && var->kind == MOF_NODE_VALUE && var->type == MOF_STRING && !var->flags)
+        string("", var->value.span.offset, var->value.span.len);
+    var = source->findChild(node, "__SUPERCLASS", MOF_ROLE_VARIABLE);
+    if (var && var->kind == MOF_NODE_VALUE && var->type == MOF_STRING && !var->flags)
+        string(" : ", var->value.span.offset, var->value.span.len);
+    fputs("\n{\n", out);
+    return MOF_VISIT_CONTINUE;
+}
+
+int MOFPrinter::qualifier(const mof_node *node)
+{
+    if (depth == 2) {
+        fputs(count++ ? ",\n " : "[", out);
+        printQualifier(node);
+    } else if (item && depth == 3) {
+        // the type says as much
+        if (source->nameEquals(node, "CIMTYPE")) {
+            cimtype = node;
+            return MOF_VISIT_SKIP;
+        }
+        fputs(count++ ? ", " : "[", out);
+        printQualifier(node);
+    }
+    return MOF_VISIT_SKIP;
+}
+
+int MOFPrinter::property(const mof_node *node)
+{
+    if (depth != 2 || (node->nlen >= 2 && source->read16(node->name) == '_'))
+        return MOF_VISIT_SKIP;
+    fputs("  ", out);
+    if (node->kind == MOF_NODE_OBJECT) {
+        item = node;
+        cimtype = nullptr;
+        count = 0;
+        return MOF_VISIT_CONTINUE;
+    }
+    type(node, nullptr);
+    fputc(' ', out);
+    name(node);
+    if (node->kind == MOF_NODE_VALUE && !(node->flags & MOF_NODE_ARRAY)) {
+        fputs(" = ", out);
+        value(&node->value);
+    } else if (node->flags & MOF_NODE_ARRAY) {
+        fputs("[]", out);
+    }
+    fputs(";\n", out);
+    return MOF_VISIT_SKIP;
+}
+
+int MOFPrinter::endItem(const mof_node *node)
+{
+    if (node != item)
+        return MOF_VISIT_CONTINUE;
+    fputs(count ? "] " : "", out);
+    type(node, cimtype);
+    fputc(' ', out);
+    name(node);
+    fputs(node->flags & MOF_NODE_ARRAY ? "[];\n" : ";\n", out);
+    item = nullptr;
+    return MOF_VISIT_CONTINUE;
+}
+
+int MOFPrinter::method(const mof_node *node)
+{
+    if (depth != 2)
+        return MOF_VISIT_SKIP;
+    fputs("  ", out);
+    printQualifiers(node, false);
+    printParameters(node);
+    fputs(";\n", out);
+    return MOF_VISIT_SKIP;
+}
+
+int MOFPrinter::endClass(const mof_node *node)
+{
+    if (node == cls)
+        fputs("};\n\n", out);
+    return MOF_VISIT_CONTINUE;
+}
+
+static FILE *output(pool *p, job *j)
+{
+    char name[4096];
+    const char *base;
+    FILE *f;
+
+    if (p->print)
+        return stdout;
+    if (!p->outdir)
+        return nullptr;
+    base = strrchr(j->path, '/');
+    base = base ? base + 1 : j->path;
+    // g1.bmf and g1.mof must not meet
+    snprintf(name, sizeof(name), "%s/%s.%s", p->outdir, base, p->format == FORMAT_JSON ? "json" : "mof");
+    f = fopen(name, "w");
+    if (!f)
+        fprintf(stderr, "Failed to create %s: %s\n", name, strerror(errno));
+    return f;
+}
+
+// Decompressed MOF from a mapped input, mof is buf itself when it was not compressed
+static int decode(job *j, char *buf, uint32_t size, char **mof)
+{
+    uint32_t *hdr = (uint32_t *)buf;
+
+    // same header check as WMI::extractBMF
+    if (size > 16 && hdr[0] == 0x424D4F46 && hdr[1] == 0x01 && hdr[2] == size - 16) {
+        j->len = hdr[3];
+        *mof = (char *)malloc(j->len ? j->len : 1);
+        if (!*mof)
+            return DUMP_IO_ERROR;
+        if (ds_dec(buf + 16, (int)size - 16, *mof, (int)j->len, 0) != (int)j->len)
+            return DUMP_INVALID;
+        return DUMP_OK;
+    }
+    // already decompressed, as MOFIndex::begin expects it
+    if (size >= 0x14 && hdr[0] == 0x424D4F46 && hdr[2] == 1 && hdr[3] == 1) {
+        j->len = size;
+        *mof = buf;
+        return DUMP_OK;
+    }
+    return DUMP_INVALID;
+}
+
+static int dump(pool *p, job *j, char *mof)
+{
+    FILE *out = nullptr;
+    double t = now();
+    int state = DUMP_OK;
+
+    if (p->format == FORMAT_JSON) {
+        OSDictionary *mData = OSDictionary::withCapacity(1);
+        MOF parser(mof, j->len, mData);
+        OSObject *result = parser.parse_bmf((char *)BMF_GUID);
+        j->parse = now() - t;
+        // as the parser counts them, the dictionary also has WDG and offsets keys
+        j->classes = parser.getStats().classes;
+        if (!parser.parsed)
+            state = DUMP_PARSE_ERROR;
+        if ((out = output(p, j))) {
+            json(out, result, 0);
+            fputc('\n', out);
+        }
+        OSSafeReleaseNULL(result);
+        OSSafeReleaseNULL(mData);
+    } else {
+        MOFIndex index(mof, j->len);
+        bool built = index.build();
+        j->classes = index.getClasses();
+        if (!built)
+            state = DUMP_PARSE_ERROR;
+        else if ((out = output(p, j))) {
+            MOFPrinter printer(out);
+            for (uint32_t i = 0; i < j->classes; i++)
+                printer.walk(&index, index.getNode(1 + i));
+        }
+        j->parse = now() - t;
+    }
+    if (out && out != stdout && fclose(out))
+        state = DUMP_IO_ERROR;
+    return state;
+}
+
+static void run(pool *p, job *j)
+{
+    char *buf, *mof = nullptr;
+    off_t size;
+    int fd;
+    double t;
+
+    fd = open(j->path, O_RDONLY);
+    size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+    if (size < 0 || size > 0x7fffffff) {
+        j->state = DUMP_IO_ERROR;
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    j->size = (uint32_t)size;
+    buf = j->size ? (char *)mmap(NULL, j->size, PROT_READ, MAP_PRIVATE, fd, 0) : (char *)MAP_FAILED;
+    close(fd);
+    if (buf == MAP_FAILED) {
+        j->state = j->size ? DUMP_IO_ERROR : DUMP_INVALID;
+        return;
+    }
+
+    t = now();
+    j->state = decode(j, buf, j->size, &mof);
+    j->decode = now() - t;
+    if (j->state == DUMP_OK)
+        j->state = dump(p, j, mof);
+    if (mof != buf)
+        free(mof);
+    munmap(buf, j->size);
+}
+
+static void *worker(void *arg)
+{
+    pool *p = (pool *)arg;
+    uint32_t i;
+
+    while ((i = p->next++) < p->count)
+        run(p, &p->jobs[i]);
+    return nullptr;
+}
+
+static int compare(const void *a, const void *b)
+{
+    return strcmp(((const job *)a)->path, ((const job *)b)->path);
+}
+
+static bool add(job **jobs, uint32_t *count, const char *path)
+{
+    job *j;
+
+    if ((*count & (*count - 1)) == 0) {
+        j = (job *)realloc(*jobs, (*count ? 2 * *count : 1) * sizeof(job));
+        if (!j)
+            return false;
+        *jobs = j;
+    }
+    j = &(*jobs)[(*count)++];
+    memset(j, 0, sizeof(job));
+    j->path = strdup(path);
+    return j->path != nullptr;
+}
+
+// Not stat, glibc's sys/stat.h brings a __u64 that clashes with bmfdec_core.h
+static bool directory(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+// Files of a directory in name order, or the path itself
+static bool collect(job **jobs, uint32_t *count, const char *path)
+{
+    char name[4096];
+    struct dirent *e;
+    uint32_t first = *count;
+    DIR *d;
+
+    if (!directory(path))
+        return add(jobs, count, path);
+    d = opendir(path);
+    if (!d) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    while ((e = readdir(d))) {
+        snprintf(name, sizeof(name), "%s/%s", path, e->d_name);
+        if (e->d_name[0] == '.' || e->d_type == DT_DIR || (e->d_type != DT_REG && directory(name)))
+            continue;
+        if (!add(jobs, count, name)) {
+            closedir(d);
+            return false;
+        }
+    }
+    closedir(d);
+    qsort(*jobs + first, *count - first, sizeof(job), compare);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t tid[MAX_THREADS];
+    double wall, decode = 0, parse = 0;
+    uint32_t errors = 0, failed = 0;
+    int threads, opt, t;
+    FILE *report;
+    pool p;
+
+    p.jobs = nullptr;
+    p.count = 0;
+    p.next = 0;
+    p.format = FORMAT_JSON;
+    p.outdir = nullptr;
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "f:j:o:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (!strcmp(optarg, "json"))
+                    p.format = FORMAT_JSON;
+                else if (!strcmp(optarg, "mof"))
+                    p.format = FORMAT_MOF;
+                else
+                    usage();
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                p.outdir = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc || threads < 1 || threads > MAX_THREADS)
+        usage();
+    for (; optind < argc; optind++)
+        if (!collect(&p.jobs, &p.count, argv[optind]))
+            return 1;
+    if (!p.count)
+        return 0;
+
+    // a single dump goes to stdout, the report then to stderr
+    p.print = !p.outdir && p.count == 1;
+    report = p.print ? stderr : stdout;
+    if ((uint32_t)threads > p.count)
+        threads = (int)p.count;
+
+    wall = now();
+    for (t = 0; t < threads; t++)
+        if (pthread_create(&tid[t], NULL, worker, &p))
+            break;
+    if (t == 0)
+        worker(&p);
+    while (t--)
+        pthread_join(tid[t], NULL);
+    wall = now() - wall;
+
+    for (uint32_t i = 0; i < p.count; i++) {
+        job *j = &p.jobs[i];
+        fprintf(report, "%s: %u bytes, %u decompressed, decode %.1f us, parse %.1f us, %u classes, %s\n",
+                j->path, j->size, j->len, j->decode * 1e6, j->parse * 1e6, j->classes, states[j->state]);
+        decode += j->decode;
+        parse += j->parse;
+        // like mofparse, a parse error is reported, not failed
+        if (j->state == DUMP_PARSE_ERROR)
+            errors++;
+        else if (j->state != DUMP_OK)
+            failed++;
+        free(j->path);
+    }
+    fprintf(report, "%u files, %u parse errors, %u failed, decode %.1f ms, parse %.1f ms, %d workers, %.1f ms\n",
+            p.count, errors, failed, decode * 1e3, parse * 1e3, threads, wall * 1e3);
+    free(p.jobs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+/*
+    mofidx.cpp - Build the flat MOF index of a BMF blob or raw MOF
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../YogaSMC/bmfdec.h"
+#include "../YogaSMC/bmfindex.hpp"
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mofidx [-n loops] [-d] input.{bmf,mof}\n"
+                    "  -n  build the index loops times and report the average\n"
+                    "  -d  dump the nodes, strings are decoded on access\n");
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *kinds[] = {"root", "class", "value", "object", "method", "flavor"};
+static const char *roles[] = {"", "class", "qualifier", "variable", "method", "parameter", "flavor"};
+
+static void dump(MOFIndex *index, const mof_node *node, int depth)
+{
+    const mof_node *child;
+    char name[256];
+
+    index->getString(node->name, node->nlen, name, sizeof(name));
+    printf("%*s%s %s %s type 0x%x%s @0x%x+0x%x", depth * 2, "", kinds[node->kind],
+           roles[node->role], name, node->type, node->flags ? "[]" : "", node->offset, node->length);
+    if (node->kind == MOF_NODE_VALUE && !node->flags) {
+        const mof_value *value = &node->value;
+        uint32_t n = mof_int_size(value->type);
+        if (value->type == MOF_STRING || value->type == MOF_DATETIME) {
+            index->getString(value->span.offset, value->span.len, name, sizeof(name));
+            printf(" \"%s\"", name);
+        } else if (n && value->size == n) {
+            if (mof_int_signed(value->type))
+                printf(" %lld", (long long)value->sint);
+            else
+                printf(" %llu", (unsigned long long)value->uint);
+        }
+    } else if (node->kind == MOF_NODE_VALUE) {
+        printf(" %u elements", node->value.size);
+    }
+    printf("\n");
+    for (uint32_t i = 0; (child = index->getChild(node, i)); i++)
+        dump(index, child, depth + 1);
+}
+
+int main(int argc, char **argv)
+{
+    long size, loops = 1, i;
+    int dumping = 0, opt, ret;
+    uint32_t *hdr, len;
+    char *raw, *mof;
+    double t;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "n:d")) != -1) {
+        switch (opt) {
+            case 'n':
+                loops = strtol(optarg, NULL, 0);
+                break;
+            case 'd':
+                dumping = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind != 1 || loops < 1)
+        usage();
+
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 16 || size > 0x7fffffff) {
+        fprintf(stderr, "Invalid input size %ld\n", size);
+        return 1;
+    }
+    raw = (char *)malloc(size);
+    if (!raw || fread(raw, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", argv[optind]);
+        return 1;
+    }
+    fclose(f);
+
+    // same header check as WMI::parseBMF
+    hdr = (uint32_t *)raw;
+    if (hdr[0] == 0x424D4F46 && hdr[1] == 0x01 && hdr[2] == size - 16) {
+        len = hdr[3];
+        mof = (char *)malloc(len);
+        ret = mof ? ds_dec(raw + 16, (int)size - 16, mof, (int)len, 0) : -1;
+        if (ret != (int)len) {
+            fprintf(stderr, "Decompress failed: %d\n", ret);
+            return 1;
+        }
+        free(raw);
+    } else {
+        len = (uint32_t)size;
+        mof = raw;
+    }
+
+    t = now();
+    for (i = 0; i < loops; i++) {
+        MOFIndex index(mof, len);
+        if (!index.build()) {
+            fprintf(stderr, "Invalid MOF\n");
+            return 1;
+        }
+        if (i + 1 < loops)
+            continue;
+        t = (now() - t) / loops;
+        if (dumping) {
+            dump(&index, index.getNode(0), 0);
+            for (uint32_t j = 0; j < index.getFlavors(); j++)
+                dump(&index, index.getFlavor(j), 0);
+        }
+        printf("%u bytes, %u classes, %u nodes, %u flavors, index %zu bytes, %.1f us\n",
+               len, index.getClasses(), index.getCount(), index.getFlavors(), index.getMemory(), t * 1e6);
+    }
+    free(mof);
+    return 0;
+}
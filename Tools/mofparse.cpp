@@ -0,0 +1,343 @@
+/*
+    mofparse.cpp - Run the kext MOF parser on a BMF blob
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../YogaSMC/bmfparser.hpp"
+
+// Most heap chunks a parse may take for scratch data, independent of size
+#define MAX_CHUNKS 2
+
+#define BMF_GUID "05901221-d566-11d1-b2f0-00a0c9062910"
+#define MAX_LOOKUPS 16
+
+static const char *lookups[MAX_LOOKUPS];
+static int nlookups;
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mofparse [-c] [-m n] [-l class]... input.bmf...\n"
+                    "  -c  fail unless scratch data took at most %d heap allocations\n"
+                    "      and every object was released, and that sint32 class\n"
+                    "      qualifiers read back at 32 bits\n"
+                    "  -m  also parse n truncated and n bit-flipped copies of the\n"
+                    "      decompressed data, build with -fsanitize=address to\n"
+                    "      catch reads outside the buffer\n"
+                    "  -l  look up a class by name or GUID in lazy mode and compare\n"
+                    "      the time with a full parse and with streaming __CLASS of\n"
+                    "      every class, -c checks the streamed names\n", MAX_CHUNKS);
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// __CLASS of every class through MOFStringVisitor, checked against the dictionaries
+static int stream(const char *path, MOF *parser, int check, uint32_t *found, double *t)
+{
+    char name[128];
+    uint32_t i, n, len;
+    int ret = 0;
+
+    n = parser->getClassCount();
+    *t = now();
+    for (i = 0; i < n; i++) {
+        MOFStringVisitor v("__CLASS", MOF_ROLE_VARIABLE, name, sizeof(name));
+        parser->visitClassAt(i, &v);
+        if (v.found(&len))
+            (*found)++;
+    }
+    *t = now() - *t;
+
+    for (i = 0; check && i < n; i++) {
+        MOFStringVisitor v("__CLASS", MOF_ROLE_VARIABLE, name, sizeof(name));
+        parser->visitClassAt(i, &v);
+        OSDictionary *dict = parser->getClassAt(i);
+        OSString *str = dict ? OSDynamicCast(OSString, dict->getObject("__CLASS")) : nullptr;
+        bool streamed = v.found(&len) && len < sizeof(name);
+        if (streamed != (str != nullptr) || (str && !str->isEqualTo(name))) {
+            fprintf(stderr, "%s: class %u streamed %s, parsed %s\n", path, i,
+                    streamed ? name : "nothing", str ? str->getCStringNoCopy() : "nothing");
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Class qualifiers of type SINT32 against their published OSNumber, which
+ * has the native width, so a negative one reads back through
+ * unsigned32BitValue() cast to int32_t.
+ */
+class SignedCheck : public MOFVisitor {
+
+public:
+    SignedCheck(OSDictionary *quals) {this->quals = quals;};
+
+    uint32_t checked {0};
+    uint32_t negative {0};
+    uint32_t bad {0};
+
+private:
+    virtual int beginClass(const mof_node *node) APPLE_KEXT_OVERRIDE {return depth == 1 ? MOF_VISIT_CONTINUE : MOF_VISIT_SKIP;};
+    virtual int property(const mof_node *node) APPLE_KEXT_OVERRIDE {return MOF_VISIT_SKIP;};
+    virtual int method(const mof_node *node) APPLE_KEXT_OVERRIDE {return MOF_VISIT_SKIP;};
+    virtual int qualifier(const mof_node *node) APPLE_KEXT_OVERRIDE {
+        char name[128];
+
+        if (depth != 2 || node->kind != MOF_NODE_VALUE || node->type != MOF_SINT32 || node->flags)
+            return MOF_VISIT_SKIP;
+        source->getString(node->name, node->nlen, name, sizeof(name));
+        OSNumber *num = quals ? OSDynamicCast(OSNumber, quals->getObject(name)) : nullptr;
+        checked++;
+        if (node->value.sint < 0)
+            negative++;
+        if (!num || num->numberOfBits() != 32 || (int32_t)num->unsigned32BitValue() != node->value.sint)
+            bad++;
+        return MOF_VISIT_SKIP;
+    };
+
+    OSDictionary *quals;
+};
+
+static int sint32(const char *path, char *mof, uint32_t len)
+{
+    OSDictionary *mData = OSDictionary::withCapacity(1);
+    uint32_t checked = 0, negative = 0, bad = 0;
+
+    {
+        MOF parser(mof, len, mData);
+        if (parser.index_bmf((char *)BMF_GUID)) {
+            for (uint32_t i = 0; i < parser.getClassCount(); i++) {
+                OSDictionary *dict = parser.getClassAt(i);
+                SignedCheck v(dict ? OSDynamicCast(OSDictionary, dict->getObject("qualifiers")) : nullptr);
+                parser.visitClassAt(i, &v);
+                checked += v.checked;
+                negative += v.negative;
+                bad += v.bad;
+            }
+        }
+    }
+    OSSafeReleaseNULL(mData);
+    if (bad)
+        fprintf(stderr, "%s: %u of %u sint32 qualifiers do not read back\n", path, bad, checked);
+    printf("%s: %u sint32 qualifiers read back, %u negative\n", path, checked - bad, negative);
+    return bad != 0;
+}
+
+// MOF::index_bmf, then only the classes asked for, as YogaWMI does at start
+static int lazy(const char *path, char *mof, uint32_t len, double eager, int check)
+{
+    double t0, t1, t2, t3 = 0;
+    uint32_t names = 0;
+    long live;
+    int i, found = 0, ret = 0;
+
+    live = OSObject::liveCount();
+    {
+        OSDictionary *mData = OSDictionary::withCapacity(1);
+        MOF parser(mof, len, mData);
+        t0 = now();
+        bool indexed = parser.index_bmf((char *)BMF_GUID);
+        t1 = now();
+        for (i = 0; indexed && i < nlookups; i++) {
+            OSDictionary *dict = parser.getClass(lookups[i]);
+            if (!dict)
+                dict = parser.getClassNamed(lookups[i]);
+            if (dict)
+                found++;
+            else
+                printf("%s: %s not found\n", path, lookups[i]);
+        }
+        t2 = now();
+        if (indexed)
+            ret |= stream(path, &parser, check, &names, &t3);
+        printf("%s: %s, full parse %.1f us, lazy index %.1f us, %d of %d lookups %.1f us, %u names streamed %.1f us\n",
+               path, indexed ? "indexed" : "index error", eager * 1e6, (t1 - t0) * 1e6,
+               found, nlookups, (t2 - t1) * 1e6, names, t3 * 1e6);
+        const mof_stats &mof = parser.getStats();
+        printf("%s: lazy memory %u objects %u bytes, heap %u, %u classes, %u nodes\n",
+               path, mof.objects, mof.bytes, mof.heap, mof.classes, mof.nodes);
+        OSSafeReleaseNULL(mData);
+    }
+    if (check && OSObject::liveCount() != live) {
+        fprintf(stderr, "%s: %ld objects leaked in lazy mode\n", path, OSObject::liveCount() - live);
+        ret = 1;
+    }
+    return ret;
+}
+
+// Runs validation and parsing over damaged copies of mof, same seed every run
+static int mutate(const char *path, const char *mof, uint32_t len, int n, int check)
+{
+    char *copy;
+    uint32_t cut, bit;
+    long live;
+    int i, k, rejected = 0, ret = 0;
+
+    srand(1);
+    for (i = 0; i < 2 * n; i++) {
+        cut = i < n ? rand() % len : len;
+        // exactly cut bytes, so ASan sees any read past the truncation
+        copy = (char *)malloc(cut ? cut : 1);
+        if (!copy)
+            return 1;
+        memcpy(copy, mof, cut);
+        if (i >= n)
+            for (k = 0; k <= i % 4; k++) {
+                bit = rand() % (len * 8);
+                copy[bit / 8] ^= 1 << bit % 8;
+            }
+
+        live = OSObject::liveCount();
+        {
+            OSDictionary *mData = OSDictionary::withCapacity(1);
+            MOF parser(copy, cut, mData);
+            OSObject *result = parser.parse_bmf((char *)BMF_GUID);
+            if (!parser.parsed)
+                rejected++;
+            OSSafeReleaseNULL(result);
+            OSSafeReleaseNULL(mData);
+        }
+        free(copy);
+        if (check && OSObject::liveCount() != live) {
+            printf("%s: %ld objects leaked by mutation %d\n", path, OSObject::liveCount() - live, i);
+            ret = 1;
+        }
+    }
+    printf("%s: %d truncated, %d bit-flipped, %d rejected\n", path, n, n, rejected);
+    return ret;
+}
+
+static int parse(const char *path, int check, int mutations)
+{
+    long size, live;
+    uint32_t *hdr, len;
+    char *raw, *mof;
+    FILE *f;
+    double eager;
+    int ret = 0;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 16 || size > 0x7fffffff) {
+        fprintf(stderr, "Invalid input size %ld\n", size);
+        return 1;
+    }
+    raw = (char *)malloc(size);
+    if (!raw || fread(raw, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return 1;
+    }
+    fclose(f);
+
+    // same steps as WMI::parseBMF
+    hdr = (uint32_t *)raw;
+    if (hdr[0] != 0x424D4F46 || hdr[1] != 0x01 || hdr[2] != size - 16) {
+        fprintf(stderr, "%s: format invalid\n", path);
+        return 1;
+    }
+    len = hdr[3];
+    if (ds_probe(raw + 16, (int)size - 16, (int)len, 0, NULL) != (int)len) {
+        fprintf(stderr, "%s: invalid stream\n", path);
+        return 1;
+    }
+    mof = (char *)malloc(len);
+    if (!mof || ds_dec(raw + 16, (int)size - 16, mof, (int)len, 0) != (int)len)
+        return 1;
+
+    live = OSObject::liveCount();
+    {
+        OSDictionary *mData = OSDictionary::withCapacity(1);
+        MOF parser(mof, len, mData);
+        eager = now();
+        OSObject *result = parser.parse_bmf((char *)BMF_GUID);
+        eager = now() - eager;
+        const mof_arena_stats &stats = parser.getArenaStats();
+        const mof_symbol_stats &names = parser.getSymbolStats();
+        OSDictionary *dict = OSDynamicCast(OSDictionary, result);
+
+        printf("%s: %u bytes, %s, %u entries, %ld objects, scratch %u chunks, %u allocations, %u bytes, peak %u\n",
+               path, len, parser.parsed ? "parsed" : "parse error", dict ? dict->getCount() : 0,
+               OSObject::liveCount() - live, stats.chunks, stats.allocs, stats.bytes, stats.peak);
+        printf("%s: %u names, %u repeated names shared, %u type labels shared\n",
+               path, names.symbols, names.hits, names.labels);
+        const mof_stats &mof = parser.getStats();
+        printf("%s: memory %u objects %u bytes, %u names %u bytes, heap %u, %u classes, %u nodes, largest class %u nodes\n",
+               path, mof.objects, mof.bytes, mof.names, mof.nameBytes, mof.heap, mof.classes, mof.nodes, mof.maxNodes);
+        if (check && stats.chunks > MAX_CHUNKS) {
+            fprintf(stderr, "%s: %u heap allocations for scratch data\n", path, stats.chunks);
+            ret = 1;
+        }
+        OSSafeReleaseNULL(result);
+        OSSafeReleaseNULL(mData);
+    }
+    if (check && OSObject::liveCount() != live) {
+        fprintf(stderr, "%s: %ld objects leaked\n", path, OSObject::liveCount() - live);
+        ret = 1;
+    }
+    if (check)
+        ret |= sint32(path, mof, len);
+    if (nlookups)
+        ret |= lazy(path, mof, len, eager, check);
+    if (mutations && len)
+        ret |= mutate(path, mof, len, mutations, check);
+    free(mof);
+    free(raw);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int check = 0, mutations = 0, opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "cm:l:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check = 1;
+                break;
+            case 'm':
+                mutations = atoi(optarg);
+                break;
+            case 'l':
+                if (nlookups == MAX_LOOKUPS)
+                    usage();
+                lookups[nlookups++] = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc)
+        usage();
+
+    for (; optind < argc; optind++)
+        ret |= parse(argv[optind], check, mutations);
+    return ret;
+}
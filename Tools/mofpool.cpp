@@ -0,0 +1,379 @@
+/*
+    mofpool.cpp - Parse the classes of a BMF blob on a pool of threads
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+
+#include "../YogaSMC/bmfparser.hpp"
+
+#define BMF_GUID "05901221-d566-11d1-b2f0-00a0c9062910"
+#define MAX_THREADS 256
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mofpool [-c] [-j threads] [-n loops] [-x copies] input.bmf...\n"
+                    "  -c  no timing, compare every pool size with MOF::parse_bmf\n"
+                    "  -j  largest pool to time, 1, 2, 4... up to it, default all cores\n"
+                    "  -n  runs per pool size, the best one counts, default 5\n"
+                    "  -x  repeat the classes of the input copies times, at most\n"
+                    "      255 classes, for larger synthetic input\n");
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Classes are length prefixed and independent, workers take the next
+ * class index until none are left. The index is built once and only read
+ * after, each worker has its own MOF in lazy mode on it, so arena and
+ * names are never shared, and objects only change threads at the join.
+ */
+struct pool {
+    char *mof;
+    uint32_t len;
+    uint32_t classes;
+    MOFIndex *index;
+    std::atomic<uint32_t> next;
+    OSDictionary **results;
+};
+
+static void *worker(void *arg)
+{
+    pool *p = (pool *)arg;
+    OSDictionary *mData = OSDictionary::withCapacity(1);
+    OSDictionary *entry = OSDictionary::withCapacity(1);
+    uint32_t i;
+
+    mData->setObject(BMF_GUID, entry);
+    entry->release();
+    MOF *parser = new MOF(p->mof, p->len, mData, p->index);
+
+    if (parser->index_bmf((char *)BMF_GUID)) {
+        while ((i = p->next++) < p->classes) {
+            OSDictionary *dict = parser->getClassAt(i);
+            if (dict) {
+                dict->retain();
+                p->results[i] = dict;
+            }
+        }
+    }
+    delete parser;
+    mData->release();
+    return nullptr;
+}
+
+/*
+ * The classes of MOF::parse_bmf, keyed by __CLASS in class order, whatever
+ * the thread count. Its "WDG" and "offsets" keys are left out, lazy mode
+ * does not parse flavors.
+ */
+static OSDictionary *parse(char *mof, uint32_t len, uint32_t classes, int threads)
+{
+    pthread_t tid[MAX_THREADS];
+    OSDictionary *dict;
+    MOFIndex index(mof, len);
+    pool p;
+    char res[20];
+    int t;
+
+    if (!index.build())
+        return nullptr;
+    p.mof = mof;
+    p.len = len;
+    p.classes = classes;
+    p.index = &index;
+    p.next = 0;
+    p.results = (OSDictionary **)calloc(classes + 1, sizeof(OSDictionary *));
+    if (!p.results)
+        return nullptr;
+
+    for (t = 0; t < threads; t++)
+        if (pthread_create(&tid[t], NULL, worker, &p))
+            break;
+    // at least the calling thread works
+    if (t == 0)
+        worker(&p);
+    while (t--)
+        pthread_join(tid[t], NULL);
+
+    dict = OSDictionary::withCapacity(classes);
+    for (uint32_t i = 0; i < classes; i++) {
+        OSDictionary *item = p.results[i];
+        if (!item)
+            continue;
+        OSString *name = OSDynamicCast(OSString, item->getObject("__CLASS"));
+        if (name) {
+            dict->setObject(name, item);
+        } else {
+            snprintf(res, sizeof(res), "class %u", i);
+            dict->setObject(res, item);
+        }
+        item->release();
+    }
+    free(p.results);
+    return dict;
+}
+
+// Deep comparison of two parse results
+static bool same(const OSObject *a, const OSObject *b)
+{
+    if (!a || !b || a->getKind() != b->getKind())
+        return a == b;
+
+    switch (a->getKind()) {
+        case OSObject::kString:
+            return OSDynamicCast(OSString, b)->isEqualTo(OSDynamicCast(OSString, a)->getCStringNoCopy());
+        case OSObject::kNumber:
+            return OSDynamicCast(OSNumber, a)->unsigned64BitValue() == OSDynamicCast(OSNumber, b)->unsigned64BitValue();
+        case OSObject::kBoolean:
+            return OSDynamicCast(OSBoolean, a)->isTrue() == OSDynamicCast(OSBoolean, b)->isTrue();
+        case OSObject::kData: {
+            OSData *x = OSDynamicCast(OSData, a), *y = OSDynamicCast(OSData, b);
+            return x->getLength() == y->getLength() && !memcmp(x->getBytesNoCopy(), y->getBytesNoCopy(), x->getLength());
+        }
+        case OSObject::kArray: {
+            OSArray *x = OSDynamicCast(OSArray, a), *y = OSDynamicCast(OSArray, b);
+            if (x->getCount() != y->getCount())
+                return false;
+            for (unsigned i = 0; i < x->getCount(); i++)
+                if (!same(x->getObject(i), y->getObject(i)))
+                    return false;
+            return true;
+        }
+        case OSObject::kDictionary: {
+            OSDictionary *x = OSDynamicCast(OSDictionary, a), *y = OSDynamicCast(OSDictionary, b);
+            if (x->getCount() != y->getCount())
+                return false;
+            for (unsigned i = 0; i < x->getCount(); i++)
+                if (!y->getKey(i)->isEqualTo(x->getKey(i)->getCStringNoCopy()) ||
+                    !same(x->getValue(i), y->getValue(i)))
+                    return false;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Classes of a pool against parse_bmf on a copy of the buffer
+static bool full(const char *path, char *mof, uint32_t len, OSDictionary *dict)
+{
+    OSDictionary *mData = OSDictionary::withCapacity(1);
+    OSDictionary *entry = OSDictionary::withCapacity(1);
+    char *copy = (char *)malloc(len);
+    uint32_t n = 0;
+    bool ok = true;
+
+    mData->setObject(BMF_GUID, entry);
+    entry->release();
+    memcpy(copy, mof, len);
+    MOF *parser = new MOF(copy, len, mData);
+    OSObject *result = parser->parse_bmf((char *)BMF_GUID);
+    OSDictionary *ref = OSDynamicCast(OSDictionary, result);
+
+    if (!ref || !parser->parsed) {
+        fprintf(stderr, "%s: parse_bmf failed\n", path);
+        ok = false;
+    }
+    for (unsigned i = 0; ok && i < ref->getCount(); i++) {
+        const OSString *key = ref->getKey(i);
+        if (key->isEqualTo("WDG") || key->isEqualTo("offsets") || key->isEqualTo("length"))
+            continue;
+        if (!same(ref->getValue(i), dict->getObject(key))) {
+            fprintf(stderr, "%s: %s differs from parse_bmf\n", path, key->getCStringNoCopy());
+            ok = false;
+        }
+        n++;
+    }
+    if (ok && n != dict->getCount()) {
+        fprintf(stderr, "%s: %u classes, parse_bmf has %u\n", path, dict->getCount(), n);
+        ok = false;
+    }
+    OSSafeReleaseNULL(result);
+    delete parser;
+    free(copy);
+    mData->release();
+    return ok;
+}
+
+// Header, the classes copies times, empty flavor table
+static char *repeat(const char *mof, uint32_t *len, uint32_t *classes, long copies)
+{
+    MOFIndex index(mof, *len);
+    uint32_t start, end, n, size;
+    char *out;
+
+    if (!index.build())
+        return nullptr;
+    n = index.getClasses();
+    if (!n || n * copies > 0xff) {
+        fprintf(stderr, "%u classes times %ld is over 255\n", n, copies);
+        return nullptr;
+    }
+    start = index.getNode(1)->offset;
+    end = index.getNode(n)->offset + index.getNode(n)->length;
+    size = start + (end - start) * copies + 0x14;
+    out = (char *)malloc(size);
+    if (!out)
+        return nullptr;
+
+    memcpy(out, mof, start);
+    for (long i = 0; i < copies; i++)
+        memcpy(out + start + (end - start) * i, mof + start, end - start);
+    memcpy(out + size - 0x14, "BMOFQUALFLAVOR11\0\0\0\0", 0x14);
+    n *= copies;
+    memcpy(out + 4, &size, 4);
+    memcpy(out + 16, &n, 4);
+    *len = size;
+    *classes = n;
+    return out;
+}
+
+static int bench(const char *path, int threads, int loops, long copies, bool check)
+{
+    long size;
+    uint32_t *hdr, len, classes;
+    char *raw, *mof, *big;
+    double t, best, base = 0;
+    OSDictionary *first = nullptr, *dict;
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 16 || size > 0x7fffffff) {
+        fprintf(stderr, "Invalid input size %ld\n", size);
+        return 1;
+    }
+    raw = (char *)malloc(size);
+    if (!raw || fread(raw, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return 1;
+    }
+    fclose(f);
+
+    hdr = (uint32_t *)raw;
+    if (hdr[0] != 0x424D4F46 || hdr[1] != 0x01 || hdr[2] != size - 16) {
+        fprintf(stderr, "%s: format invalid\n", path);
+        return 1;
+    }
+    len = hdr[3];
+    mof = (char *)malloc(len);
+    if (!mof || ds_dec(raw + 16, (int)size - 16, mof, (int)len, 0) != (int)len) {
+        fprintf(stderr, "%s: decompress failed\n", path);
+        return 1;
+    }
+    free(raw);
+
+    {
+        MOFIndex index(mof, len);
+        if (!index.build()) {
+            fprintf(stderr, "%s: invalid MOF\n", path);
+            return 1;
+        }
+        classes = index.getClasses();
+    }
+    if (copies > 1) {
+        big = repeat(mof, &len, &classes, copies);
+        if (!big)
+            return 1;
+        free(mof);
+        mof = big;
+    }
+    printf("%s: %u classes, %u bytes\n", path, classes, len);
+
+    for (int n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+        best = 0;
+        for (int i = 0; i < loops; i++) {
+            t = now();
+            dict = parse(mof, len, classes, n);
+            t = now() - t;
+            if (!dict)
+                return 1;
+            if (!best || t < best)
+                best = t;
+            if (!first) {
+                first = dict;
+                if (check && !full(path, mof, len, first))
+                    ret = 1;
+            } else {
+                if (!same(first, dict)) {
+                    fprintf(stderr, "%s: %d threads gave a different result\n", path, n);
+                    ret = 1;
+                }
+                dict->release();
+            }
+        }
+        if (n == 1)
+            base = best;
+        if (!check)
+            printf("  %3d threads %10.1f us %6.2fx\n", n, best * 1e6, base / best);
+        if (n == threads)
+            break;
+    }
+    OSSafeReleaseNULL(first);
+    free(mof);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    long copies = 1;
+    int threads, loops = 5, opt, ret = 0;
+    bool check = false;
+
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "cj:n:x:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check = true;
+                loops = 1;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                loops = atoi(optarg);
+                break;
+            case 'x':
+                copies = strtol(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc || threads < 1 || threads > MAX_THREADS || loops < 1 || copies < 1)
+        usage();
+
+    for (; optind < argc; optind++)
+        ret |= bench(argv[optind], threads, loops, copies, check);
+    return ret;
+}
@@ -0,0 +1,221 @@
+/*
+    mofutf.c - Check and time the MOF UTF-16LE to UTF-8 transcoder
+    Copyright (C) 2020  Zhen
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+*/
+
+/*
+ * Without arguments mof_utf8_len and mof_utf16_to_utf8 are compared
+ * against the conversion MOF::parse_string used to do, on fixed cases
+ * (surrogates, embedded NULs, block edges) and random strings at every
+ * alignment and output size. -b times both against the per-unit path.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../YogaSMC/bmfutf.h"
+
+#define MAX_UNITS 64
+
+static int failed;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// The old parse_string loop, minus its duplicated surrogate branch
+static uint32_t naive(const uint16_t *buf2, uint32_t n, uint8_t *out)
+{
+    uint32_t i, j;
+    for (i = 0, j = 0; i < n; ++i) {
+        if (buf2[i] == 0) {
+            break;
+        } else if (buf2[i] < 0x80) {
+            out[j++] = buf2[i];
+        } else if (buf2[i] < 0x800) {
+            out[j++] = 0xC0 | (buf2[i] >> 6);
+            out[j++] = 0x80 | (buf2[i] & 0x3F);
+        } else if (buf2[i] >= 0xD800 && buf2[i] <= 0xDBFF && i+1 < n && buf2[i+1] >= 0xDC00 && buf2[i+1] <= 0xDFFF) {
+            uint32_t c = 0x10000 + ((buf2[i] - 0xD800) << 10) + (buf2[i+1] - 0xDC00);
+            ++i;
+            out[j++] = 0xF0 | (c >> 18);
+            out[j++] = 0x80 | ((c >> 12) & 0x3F);
+            out[j++] = 0x80 | ((c >> 6) & 0x3F);
+            out[j++] = 0x80 | (c & 0x3F);
+        } else {
+            out[j++] = 0xE0 | (buf2[i] >> 12);
+            out[j++] = 0x80 | ((buf2[i] >> 6) & 0x3F);
+            out[j++] = 0x80 | (buf2[i] & 0x3F);
+        }
+    }
+    out[j] = 0;
+    return j;
+}
+
+static void check(const char *name, const uint16_t *units, uint32_t n)
+{
+    uint8_t src[2 * MAX_UNITS + 8], want[4 * MAX_UNITS + 1], got[4 * MAX_UNITS + 8], ref[4 * MAX_UNITS + 8];
+    uint32_t len, ret, off, size, k;
+
+    len = naive(units, n, want);
+    for (off = 0; off < 8; off++) {
+        // little endian units at every alignment
+        for (k = 0; k < n; k++) {
+            src[off + 2 * k] = units[k];
+            src[off + 2 * k + 1] = units[k] >> 8;
+        }
+        if (mof_utf8_len(src + off, n) != len || mof_utf8_len_ref(src + off, n) != len) {
+            printf("%s: length %u, expected %u\n", name, mof_utf8_len(src + off, n), len);
+            failed++;
+            return;
+        }
+        for (size = 0; size <= len + 2; size++) {
+            memset(got, 0xAA, sizeof(got));
+            ret = mof_utf16_to_utf8(src + off, n, (char *)got, size);
+            if (size > len) {
+                if (ret != len || memcmp(got, want, len + 1) || got[len + 1] != 0xAA) {
+                    printf("%s: wrong output at offset %u, size %u\n", name, off, size);
+                    failed++;
+                    return;
+                }
+                continue;
+            }
+            // truncated to whole sequences, same as the per-unit path
+            k = size ? ret + 1 : 0;
+            if ((size && (ret >= size || memcmp(got, want, ret) || got[ret] != 0 ||
+                          (want[ret] & 0xC0) == 0x80)) || got[k] != 0xAA ||
+                ret != mof_utf16_to_utf8_ref(src + off, n, (char *)ref, size)) {
+                printf("%s: wrong truncation at offset %u, size %u\n", name, off, size);
+                failed++;
+                return;
+            }
+        }
+    }
+}
+
+static uint16_t pick(void)
+{
+    switch (rand() % 8) {
+        case 0: return 0x80 + rand() % 0x780;             // 2 bytes
+        case 1: return 0x800 + rand() % 0xD000;           // 3 bytes
+        case 2: return 0xD800 + rand() % 0x400;           // high surrogate
+        case 3: return 0xDC00 + rand() % 0x400;           // low surrogate
+        case 4: return rand() % 16 ? 0x20 + rand() % 0x5F : 0;
+        default: return 0x20 + rand() % 0x5F;
+    }
+}
+
+static void selftest(void)
+{
+    static const struct {
+        const char *name;
+        uint16_t units[24];
+        uint32_t n;
+    } cases[] = {
+        {"empty", {0}, 0},
+        {"nul", {0, 'A'}, 2},
+        {"ascii 7", {'A','B','C','D','E','F','G'}, 7},
+        {"ascii 8", {'A','B','C','D','E','F','G','H'}, 8},
+        {"ascii 17", {'a','b','c','d','e','f','g','h','i','j','k','l','m','n','o','p','q'}, 17},
+        {"nul in block", {'a','b','c',0,'e','f','g','h','i'}, 9},
+        {"nul after block", {'a','b','c','d','e','f','g','h',0,'j'}, 10},
+        {"del", {'a','b','c','d','e','f','g',0x7F,0x80}, 9},
+        {"two bytes", {'a',0xE9,'b',0x7FF,0x800}, 5},
+        {"three bytes", {0x65E5,0x672C,0x8A9E,0xFFFF}, 4},
+        {"pair", {'a',0xD83D,0xDE00,'b'}, 4},
+        {"pair at block edge", {'a','b','c','d','e','f','g',0xD83D,0xDE00}, 9},
+        {"pair cut by count", {'a',0xD83D,0xDE00}, 2},
+        {"lone high", {0xD800,'a'}, 2},
+        {"lone high at end", {'a',0xDBFF}, 2},
+        {"lone low", {0xDC00,0xD800}, 2},
+        {"high high low", {0xD800,0xD801,0xDC01}, 3},
+        {"pair then nul", {0xDBFF,0xDFFF,0,'x'}, 4},
+        {"non-ascii after 8", {'A','B','C','D','E','F','G','H',0x100,'I','J','K','L','M','N','O','P','Q'}, 18},
+    };
+    uint16_t units[MAX_UNITS];
+    uint32_t i, k, n;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        check(cases[i].name, cases[i].units, cases[i].n);
+
+    srand(1);
+    for (i = 0; i < 20000; i++) {
+        n = rand() % MAX_UNITS;
+        // mostly ASCII, like MOF strings
+        for (k = 0; k < n; k++)
+            units[k] = rand() % 4 ? 0x20 + rand() % 0x5F : pick();
+        check("random", units, n);
+    }
+    printf("%s\n", failed ? "FAILED" : "passed");
+}
+
+static void bench(void)
+{
+    static const char *words[] = {"CurrentSetting", "InstanceName", "ValueMap", "Lenovo_BiosSetting", "string",
+                                  "Return the current BIOS setting by index, the value is a comma separated list"};
+    uint32_t n = 0, len, sum = 0, i, k, loops = 2000;
+    uint16_t *units = (uint16_t *)malloc(1 << 20);
+    char *out = (char *)malloc(1 << 20);
+    double t, t0;
+    const char *w;
+
+    // NUL terminated identifiers back to back
+    while (n < (1 << 18) - 64) {
+        for (w = words[rand() % 6]; *w; w++)
+            units[n++] = *w;
+        units[n++] = 0;
+    }
+    for (k = 0; k < 2; k++) {
+        t0 = now();
+        for (i = 0; i < loops; i++) {
+            uint16_t *p = units, *e = units + n;
+            while (p < e) {
+                uint32_t m = (uint32_t)(e - p);
+                len = k ? mof_utf8_len_ref(p, m) : mof_utf8_len(p, m);
+                len = k ? mof_utf16_to_utf8_ref(p, m, out, len + 1) : mof_utf16_to_utf8(p, m, out, len + 1);
+                sum += len + out[0];
+                p += len + 1;
+            }
+        }
+        t = now() - t0;
+        printf("%-10s %8.1f MB/s of UTF-16\n", k ? "per unit" : "blocks", 2.0 * n * loops / t / 1e6);
+    }
+    if (!sum)
+        printf("\n");
+    free(units);
+    free(out);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        switch (opt) {
+            case 'b':
+                bench();
+                return 0;
+            default:
+                fprintf(stderr, "usage: mofutf [-b]\n");
+                return 1;
+        }
+    }
+    selftest();
+    return failed != 0;
+}
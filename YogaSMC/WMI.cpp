@@ -24,6 +24,8 @@
 #include "common.h"
 
 #include "WMI.h"
+#include <IOKit/IODeviceTreeSupport.h>
+#include <pexpert/pexpert.h>
 #include <uuid/uuid.h>
 
 #define kWMIMethod "_WDG"
@@ -97,8 +99,11 @@ WMI::WMI(IOService* provider)
 
 bool WMI::initialize()
 {
+    int flag;
+
     if (mDevice != NULL) {
         mData = OSDictionary::withCapacity(0);
+        mLazy = PE_parse_boot_argn(kWMILazyArg, &flag, sizeof(flag));
             
         if (extractData()) {
             return true;
@@ -111,6 +116,15 @@ bool WMI::initialize()
 
 WMI::~WMI()
 {
+    if (mMOF)
+        delete mMOF;
+    if (mMOFData)
+        delete[] mMOFData;
+    if (mSchema)
+        delete mSchema;
+    if (mCache)
+        delete mCache;
+    OSSafeReleaseNULL(mBMF);
     OSSafeReleaseNULL(mData);
 }
 
@@ -139,7 +153,9 @@ bool WMI::extractData()
         parseWDGEntry(
           (struct WMI_DATA*)data->getBytesNoCopy(i * WMI_DATA_SIZE, WMI_DATA_SIZE));
     }
-    
+    // before classes from the MOF are linked in
+    MOF::measure(mData, &mWDGObjects, &mWDGBytes);
+
     if (bmf_guid_string != NULL)
         extractBMF();
 
@@ -235,6 +251,49 @@ OSDictionary* WMI::getMethod(const char * guid, UInt8 flg)
     return NULL;
 }
 
+// MOF class describing a GUID, parsed on first use in lazy mode
+OSDictionary* WMI::getMOF(const char * guid)
+{
+    OSDictionary* entry = getMethod(guid);
+
+    if (entry == NULL)
+        return NULL;
+    // schema from the cache, the BMF is only parsed for a whole class
+    if (mBMF) {
+        parseBMF(mBMF, "BMF");
+        OSSafeReleaseNULL(mBMF);
+    }
+    if (mMOF && !entry->getObject("MOF"))
+        mMOF->getClass(guid);
+    return OSDynamicCast(OSDictionary, entry->getObject("MOF"));
+}
+
+// __CLASS of the MOF class describing a GUID, streamed without parsing the class in lazy mode
+UInt32 WMI::getMOFName(const char * guid, char * name, UInt32 size)
+{
+    uint32_t len;
+
+    if (mSchema) {
+        const mof_schema_class *cls = mSchema->getClass(guid);
+        if (cls == NULL || !cls->name)
+            return 0;
+        return (UInt32)strlcpy(name, mSchema->getString(cls->name), size);
+    }
+
+    if (mMOF) {
+        MOFStringVisitor visitor("__CLASS", MOF_ROLE_VARIABLE, name, size);
+        mMOF->visitClass(guid, &visitor);
+        return visitor.found(&len) ? len : 0;
+    }
+
+    OSDictionary* mof = getMOF(guid);
+    OSString* str = mof ? OSDynamicCast(OSString, mof->getObject("__CLASS")) : NULL;
+
+    if (str == NULL)
+        return 0;
+    return (UInt32)strlcpy(name, str->getCStringNoCopy(), size);
+}
+
 bool WMI::hasMethod(const char * guid, UInt8 flg)
 {
     OSDictionary* method = getMethod(guid, flg);
@@ -352,28 +411,218 @@ bool WMI::extractBMF()
 
     mDevice->setProperty("BMF size", data->getLength(), sizeof(unsigned int)*8);
 
+    mDevice->removeProperty("MOF");
+    mDevice->removeProperty("BMF data");
+    if (!mLazy) {
+        bool ok = parseBMF(data, methodName);
+        OSSafeReleaseNULL(data);
+        return ok;
+    }
+
+    // the schema of an earlier start spares ds_dec and the index
+    uint64_t key = mof_hash(pin, len);
+    if (!loadSchema(key, len)) {
+        if (!parseBMF(data, methodName)) {
+            OSSafeReleaseNULL(data);
+            return false;
+        }
+        storeSchema(key, len);
+    } else {
+        DebugLog("%s: %s schema loaded from cache\n", mDevice->getName(), methodName);
+        mDevice->setProperty("MOF size", pin[3], sizeof(uint32_t)*8);
+    }
+    // with a schema the MOF is dropped until getMOF needs a whole class
+    if (mSchema && mMOF) {
+        mMOFStats = mMOF->getStats();
+        delete mMOF;
+        mMOF = nullptr;
+        delete[] mMOFData;
+        mMOFData = nullptr;
+    }
+    if (mSchema)
+        mBMF = data;
+    else
+        OSSafeReleaseNULL(data);
+    return true;
+}
+
+// Decompresses and parses a BMF checked by extractBMF
+bool WMI::parseBMF(OSData *data, const char *methodName)
+{
+    uint32_t *pin = (uint32_t *)(data->getBytesNoCopy());
+    uint32_t len = data->getLength();
     uint32_t size = pin[3];
+    // Validate the stream before trusting the declared size for allocation
+    int probe = ds_probe((char *)pin+16, len-16, size, 0, nullptr);
+    if (probe < 0 || (uint32_t)probe != size) {
+        AlwaysLog("%s: %s invalid stream %d, expected size %d\n", mDevice->getName(), methodName, probe, size);
+        return false;
+    }
+
     char *pout = new char[size];
     if (ds_dec((char *)pin+16, len-16, pout, size, 0) != size) {
         AlwaysLog("%s: %s Decompress failed\n", mDevice->getName(), methodName);
+        delete[] pout;
         return false;
     }
-    pin = nullptr;
 
     mDevice->setProperty("MOF size", size, sizeof(uint32_t)*8);
-        
-    MOF mof(pout, size, mData);
-    mDevice->removeProperty("MOF");
-    mDevice->removeProperty("BMF data");
-    OSObject *result = mof.parse_bmf(bmf_guid_string);
-    mDevice->setProperty("MOF", result);
-    if (!mof.parsed)
+
+    if (!mLazy) {
+        // every class, published in full
+        MOF mof(pout, size, mData);
+        OSObject *result = mof.parse_bmf(bmf_guid_string);
+        mDevice->setProperty("MOF", result);
+        mMOFStats = mof.getStats();
+        mRegistryBytes += mMOFStats.bytes;
+        if (!mof.parsed) {
+            mDevice->setProperty("BMF data", data);
+            mRegistryBytes += len;
+        }
+        OSSafeReleaseNULL(result);
+        delete[] pout;
+        return true;
+    }
+
+    // classes are parsed by getMOF when first looked up
+    mMOF = new MOF(pout, size, mData);
+    mMOFData = pout;
+    if (!mMOF->index_bmf(bmf_guid_string)) {
         mDevice->setProperty("BMF data", data);
-//    else
+        mRegistryBytes += len;
+        mMOFStats = mMOF->getStats();
+        delete mMOF;
+        mMOF = nullptr;
+        delete[] pout;
+        mMOFData = nullptr;
+    }
+    return true;
+}
+
+// Schema stored for this BMF, it also has to agree with the notify ids of _WDG
+bool WMI::loadSchema(uint64_t key, uint32_t length)
+{
+    if (mCache == NULL)
+        return false;
+
+    OSData *data = mCache->load(key);
+    mSchema = MOFSchema::withData(data, key, length);
     OSSafeReleaseNULL(data);
-    
-    OSSafeReleaseNULL(result);
-    delete[] pout;
-    
+    if (mSchema == NULL)
+        return false;
+    mSchemaBytes = mSchema->getSize();
+
+    for (uint32_t i = 0; i < mSchema->getClassCount(); i++) {
+        const mof_schema_class *cls = mSchema->getClassAt(i);
+        OSDictionary *entry = OSDynamicCast(OSDictionary, mData->getObject(mSchema->getString(cls->guid)));
+        OSNumber *id = entry ? OSDynamicCast(OSNumber, entry->getObject(kWMINotifyId)) : NULL;
+        bool notify = cls->flags & MOF_SCHEMA_NOTIFY;
+        if ((id != NULL) != notify || (id != NULL && id->unsigned8BitValue() != cls->notify)) {
+            AlwaysLog("%s: cached schema does not match _WDG\n", mDevice->getName());
+            delete mSchema;
+            mSchema = nullptr;
+            mSchemaBytes = 0;
+            return false;
+        }
+    }
     return true;
 }
+
+/*
+ * Compiles the names of the _WDG classes indexed by parseBMF for later
+ * starts. Once stored it also serves this start, so the MOF can go.
+ */
+void WMI::storeSchema(uint64_t key, uint32_t length)
+{
+    MOFSchemaBuilder builder(false);
+    OSData *data;
+    uint32_t i;
+
+    if (mCache == NULL || mMOF == NULL)
+        return;
+
+    for (i = 0; i < mMOF->getClassCount(); i++) {
+        const char *guid = mMOF->getClassGUID(i);
+        OSDictionary *entry = guid[0] ? OSDynamicCast(OSDictionary, mData->getObject(guid)) : NULL;
+        OSNumber *id = entry ? OSDynamicCast(OSNumber, entry->getObject(kWMINotifyId)) : NULL;
+        // getMOFName is only asked for GUIDs of _WDG
+        if (entry == NULL)
+            continue;
+        if (!builder.add(mMOF, i, id ? id->unsigned8BitValue() : -1))
+            break;
+    }
+    data = i == mMOF->getClassCount() ? builder.finish(key, length) : NULL;
+    if (data == NULL || !mCache->store(key, data)) {
+        AlwaysLog("%s: schema not cached\n", mDevice->getName());
+    } else {
+        mSchema = MOFSchema::withData(data, key, length);
+        if (mSchema)
+            mSchemaBytes = mSchema->getSize();
+    }
+    OSSafeReleaseNULL(data);
+}
+
+OSDictionary* WMI::getStats()
+{
+    // classes parsed since are counted by a MOF still kept
+    const mof_stats &mof = mMOF ? mMOF->getStats() : mMOFStats;
+    const struct {
+        const char *key;
+        uint32_t value;
+    } counts[] = {
+        {"WDG objects", mWDGObjects},
+        {"WDG bytes", mWDGBytes},
+        {"MOF objects", mof.objects},
+        {"MOF bytes", mof.bytes},
+        {"MOF names", mof.names},
+        {"MOF name bytes", mof.nameBytes},
+        {"MOF heap", mof.heap},
+        {"MOF peak", mof.peak},
+        {"MOF classes", mof.classes},
+        {"MOF nodes", mof.nodes},
+        {"MOF max nodes", mof.maxNodes},
+        {"Registry bytes", mRegistryBytes},
+        {"Schema bytes", mSchemaBytes},
+    };
+    OSDictionary *stats = OSDictionary::withCapacity(sizeof(counts) / sizeof(counts[0]));
+    OSNumber *value;
+
+    for (uint32_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        value = OSNumber::withNumber(counts[i].value, 32);
+        stats->setObject(counts[i].key, value);
+        value->release();
+    }
+    return stats;
+}
+
+WMINVRAMStore::WMINVRAMStore()
+{
+    mNVRAM = IORegistryEntry::fromPath("/options", gIODTPlane);
+}
+
+WMINVRAMStore::~WMINVRAMStore()
+{
+    OSSafeReleaseNULL(mNVRAM);
+}
+
+// Only a schema for key, the rest of it is checked by MOFSchema::withData
+OSData* WMINVRAMStore::load(uint64_t key)
+{
+    OSData *data = mNVRAM ? OSDynamicCast(OSData, mNVRAM->getProperty(kWMICache)) : NULL;
+    const mof_schema_header *hdr;
+
+    if (data == NULL || data->getLength() < sizeof(mof_schema_header))
+        return NULL;
+    hdr = (const mof_schema_header *)data->getBytesNoCopy();
+    if (hdr->key != key)
+        return NULL;
+    data->retain();
+    return data;
+}
+
+bool WMINVRAMStore::store(uint64_t key, OSData *data)
+{
+    if (mNVRAM == NULL || data->getLength() > kWMICacheMax)
+        return false;
+    return mNVRAM->setProperty(kWMICache, data);
+}
@@ -20,12 +20,19 @@
 #ifndef WMI_h
 #define WMI_h
 
+#include "bmfcache.hpp"
+#include "bmfparser.hpp"
+
 #define kWMIGuid "guid"
 #define kWMIObjectId "object-id"
 #define kWMINotifyId "notify-id"
 #define kWMIInstanceCount "instance-count"
 #define kWMIFlags "flags"
 #define kWMIFlagsText "flags-text"
+// NVRAM variable of the schema cache, under a vendor GUID of its own
+#define kWMICache "2F96A451-399D-4944-8DED-8C03E1F6345D:yogawmi-bmf-schema"
+#define kWMICacheMax 0x400                  // bytes, NVRAM space is scarce
+#define kWMILazyArg "-wmilazy"   // boot-arg, classes parsed on first use and "MOF" left out
 
 #define DESC_WMI_GUID "05901221-D566-11D1-B2F0-00A0C9062910"
 
@@ -48,11 +55,40 @@ enum {
     ACPI_WMI_EVENT     = 0x8
 };
 
+/*
+ * Schema cache in an NVRAM variable, so it survives a restart and spares
+ * the next start decompressing and indexing the BMF. Only used with the
+ * -wmilazy boot-arg. One schema is kept, the one of the last BMF stored,
+ * and it only has the names and notify-ids of the _WDG classes.
+ */
+class WMINVRAMStore : public MOFCacheStore
+{
+    IORegistryEntry* mNVRAM;
+
+public:
+    WMINVRAMStore();
+    virtual ~WMINVRAMStore();
+
+    virtual OSData* load(uint64_t key) APPLE_KEXT_OVERRIDE;
+    virtual bool store(uint64_t key, OSData *data) APPLE_KEXT_OVERRIDE;
+};
+
 class WMI
 {
     IOACPIPlatformDevice* mDevice {nullptr};
     OSDictionary* mData = {nullptr};
     OSDictionary* mEvent = {nullptr};
+    MOF* mMOF {nullptr};
+    char* mMOFData {nullptr};
+    MOFCacheStore* mCache {nullptr};
+    MOFSchema* mSchema {nullptr};
+    OSData* mBMF {nullptr};     // BMF of a cached schema, parsed if getMOF needs it
+    uint32_t mWDGObjects {0};
+    uint32_t mWDGBytes {0};
+    uint32_t mRegistryBytes {0};        // "BMF data" and "MOF" properties
+    uint32_t mSchemaBytes {0};          // schema loaded or stored
+    mof_stats mMOFStats {};             // of a MOF no longer kept
+    bool mLazy {false};
 
 public:
     // Constructor
@@ -60,16 +96,26 @@ public:
     // Destructor
     ~WMI();
 
+    // Takes store, call before initialize
+    inline void setCache(MOFCacheStore *store) { mCache = store; }
     bool initialize();
     bool hasMethod(const char * guid, UInt8 flg = ACPI_WMI_METHOD);
     bool executeMethod(const char * guid, OSObject ** result = 0, OSObject * params[] = 0, IOItemCount paramCount = 0);
     bool executeinteger(const char * guid, UInt32 * result, OSObject * params[] = 0, IOItemCount paramCount = 0);
     inline IOACPIPlatformDevice* getACPIDevice() { return mDevice; }
     inline OSDictionary* getEvent() { return mEvent; }
+    OSDictionary* getMOF(const char * guid);
+    // Length of the __CLASS name, 0 if none, name only holds it if shorter than size
+    UInt32 getMOFName(const char * guid, char * name, UInt32 size);
+    // Objects and bytes taken so far, released by the caller
+    OSDictionary* getStats();
 
 private:
     bool extractData();
     bool extractBMF();
+    bool parseBMF(OSData *data, const char *methodName);
+    bool loadSchema(uint64_t key, uint32_t length);
+    void storeSchema(uint64_t key, uint32_t length);
     void parseWDGEntry(struct WMI_DATA * block);
     
     OSDictionary* getMethod(const char * guid, UInt8 flg = 0);
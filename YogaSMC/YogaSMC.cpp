@@ -74,29 +74,40 @@ void YogaWMI::getNotifyID(OSString *key) {
         IOLog("%s: notify id %s mismatch %x\n", getName(), key->getCStringNoCopy(), id->unsigned8BitValue());
     }
 
-    OSDictionary *mof = OSDynamicCast(OSDictionary, item->getObject("MOF"));
-    if (mof == NULL) {
+    OSString *guid = OSDynamicCast(OSString, item->getObject(kWMIGuid));
+    if (guid == NULL) {
         IOLog("%s: found notify id 0x%x with no description\n", getName(), id->unsigned8BitValue());
         return;
     }
-    OSString *name = OSDynamicCast(OSString, mof->getObject("__CLASS"));
-    if (name == NULL) {
+    // only the name is needed, the class is not parsed for it
+    char buf[64], *name = buf;
+    UInt32 len = YWMI->getMOFName(guid->getCStringNoCopy(), buf, sizeof(buf));
+    if (len >= sizeof(buf)) {
+        name = (char *)IOMalloc(len + 1);
+        if (name != NULL && YWMI->getMOFName(guid->getCStringNoCopy(), name, len + 1) != len) {
+            IOFree(name, len + 1);
+            name = NULL;
+        }
+    }
+    if (len == 0 || name == NULL) {
         IOLog("%s: found notify id 0x%x with no __CLASS\n", getName(), id->unsigned8BitValue());
         return;
     }
     switch (id->unsigned8BitValue()) {
         case kIOACPIMessageReserved:
-            IOLog("%s: found reserved notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name->getCStringNoCopy());
+            IOLog("%s: found reserved notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name);
             break;
             
         case kIOACPIMessageD0:
-            IOLog("%s: found YMC notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name->getCStringNoCopy());
+            IOLog("%s: found YMC notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name);
             break;
             
         default:
-            IOLog("%s: found unknown notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name->getCStringNoCopy());
+            IOLog("%s: found unknown notify id 0x%x for %s\n", getName(), id->unsigned8BitValue(), name);
             break;
     }
+    if (name != buf)
+        IOFree(name, len + 1);
     // TODO: Event Enable and Disable WExx; Data Collection Enable and Disable WCxx
 }
 
@@ -106,6 +117,8 @@ bool YogaWMI::start(IOService *provider)
     IOLog("%s: Starting\n", getName());
 
     YWMI = new WMI(provider);
+    // schema of the BMF, kept in NVRAM for the next start in lazy mode
+    YWMI->setCache(new WMINVRAMStore());
     YWMI->initialize();
 
     if (YWMI->hasMethod(YMC_WMI_EVENT, ACPI_WMI_EVENT)) {
@@ -141,6 +154,11 @@ bool YogaWMI::start(IOService *provider)
         }
     }
 
+    // after the lookups above, which may have parsed classes
+    OSDictionary *stats = YWMI->getStats();
+    setProperty("YogaWMI,Stats", stats);
+    OSSafeReleaseNULL(stats);
+
     findVPC();
 
     workLoop = IOWorkLoop::workLoop();
@@ -0,0 +1,68 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfarena.cpp
+//  YogaSMC
+//
+//  Bump allocator for scratch data of the MOF parser.
+//
+
+#include "bmfarena.hpp"
+
+void *MOFArena::alloc(uint32_t len) {
+    chunk *c;
+    uint32_t size;
+
+    len = (len + 7) & ~7U;
+    if (!cur && head) {
+        cur = head;
+        used = sizeof(chunk);
+    }
+    // move on to a later chunk, reusing the ones kept by rewind
+    while (!cur || cur->size - used < len) {
+        if (cur && cur->next) {
+            cur = cur->next;
+            used = sizeof(chunk);
+            continue;
+        }
+        size = len + sizeof(chunk) > MOF_ARENA_CHUNK ? len + sizeof(chunk) : MOF_ARENA_CHUNK;
+        c = (chunk *)IOMalloc(size);
+        if (!c)
+            return nullptr;
+        c->next = nullptr;
+        c->size = size;
+        if (cur)
+            cur->next = c;
+        else
+            head = c;
+        cur = c;
+        used = sizeof(chunk);
+        stats.chunks++;
+        stats.heap += size;
+    }
+
+    void *p = (char *)cur + used;
+    used += len;
+    inuse += len;
+    stats.allocs++;
+    stats.bytes += len;
+    if (inuse > stats.peak)
+        stats.peak = inuse;
+    return p;
+}
+
+void MOFArena::rewind(const Mark &m) {
+    cur = (chunk *)m.chunk;
+    used = m.used;
+    inuse = m.inuse;
+}
+
+void MOFArena::release() {
+    chunk *c;
+
+    while ((c = head)) {
+        head = c->next;
+        IOFree(c, c->size);
+    }
+    cur = nullptr;
+    used = inuse = 0;
+}
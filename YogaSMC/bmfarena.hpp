@@ -0,0 +1,70 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfarena.hpp
+//  YogaSMC
+//
+//  Bump allocator for scratch data of the MOF parser.
+//
+
+#ifndef bmfarena_hpp
+#define bmfarena_hpp
+
+#include <IOKit/IOLib.h>
+
+#define MOF_ARENA_CHUNK 4096
+
+struct mof_arena_stats {
+    uint32_t chunks;    // heap allocations
+    uint32_t allocs;    // arena allocations
+    uint32_t bytes;     // bytes handed out
+    uint32_t peak;      // most bytes in use at once
+    uint32_t heap;      // bytes of the chunks
+};
+
+/*
+ * Chunks are kept until release(), rewinding to a mark only moves the
+ * bump pointer back, so parsing that rewinds per item stays on its first
+ * chunk. Memory is not zeroed.
+ */
+class MOFArena {
+
+public:
+    MOFArena() {};
+    ~MOFArena() {release();};
+
+    struct Mark {
+        void *chunk;
+        uint32_t used;
+        uint32_t inuse;
+    };
+
+    void *alloc(uint32_t len);
+    Mark mark() {return {cur, used, inuse};};
+    void rewind(const Mark &m);
+    void release();
+    const mof_arena_stats &getStats() {return stats;};
+
+    // Rewinds to the mark taken at construction when leaving the scope
+    class Scope {
+    public:
+        Scope(MOFArena *arena) {this->arena = arena; m = arena->mark();};
+        ~Scope() {arena->rewind(m);};
+    private:
+        MOFArena *arena;
+        Mark m;
+    };
+
+private:
+    struct chunk {
+        chunk *next;
+        uint32_t size;
+    };
+
+    chunk *head {nullptr};
+    chunk *cur {nullptr};
+    uint32_t used {0};
+    uint32_t inuse {0};
+    mof_arena_stats stats {};
+};
+
+#endif /* bmfarena_hpp */
@@ -0,0 +1,319 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfcache.cpp
+//  YogaSMC
+//
+//  Compiled schema of a BMF, kept between starts, see MOFSchema.
+//
+
+#include "bmfcache.hpp"
+#include "bmfparser.hpp"
+
+#define MOF_HASH_C1 0x87c37b91114253d5ULL
+#define MOF_HASH_C2 0x4cf5ad432745937fULL
+
+static inline uint64_t rotl64(uint64_t v, int r) {
+    return v << r | v >> (64 - r);
+}
+
+static inline uint64_t mof_hash_word(uint64_t k) {
+    return rotl64(k * MOF_HASH_C1, 31) * MOF_HASH_C2;
+}
+
+/*
+ * MurmurHash3 rounds over a single lane of 64 bit words, the buffers are
+ * tens of kB and are read once, so one lane is fast enough.
+ */
+uint64_t mof_hash(const void *buf, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t h = len, k;
+    uint32_t n;
+
+    for (n = len; n >= 8; n -= 8, p += 8) {
+        memcpy(&k, p, 8);
+        h ^= mof_hash_word(k);
+        h = rotl64(h, 27) * 5 + 0x52dce729;
+    }
+    k = 0;
+    memcpy(&k, p, n);
+    h ^= mof_hash_word(k) ^ len;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static bool mof_int(const mof_node *node, uint32_t *value) {
+    if (!node || node->kind != MOF_NODE_VALUE || node->flags || !mof_int_size(node->type) ||
+        node->value.size != mof_int_size(node->type))
+        return false;
+    *value = (uint32_t)node->value.uint;
+    return true;
+}
+
+static bool mof_qualifier_true(MOFIndex *index, const mof_node *node, const char *name) {
+    const mof_node *q = index->findChild(node, name, MOF_ROLE_QUALIFIER);
+
+    return q && q->kind == MOF_NODE_VALUE && q->type == MOF_BOOLEAN && !q->flags && q->value.uint;
+}
+
+MOFSchemaBuilder::MOFSchemaBuilder(bool methods) {
+    with_methods = methods;
+    // offset 0 is the empty string
+    ok = append(&strings, "", 1);
+}
+
+MOFSchemaBuilder::~MOFSchemaBuilder() {
+    mof_table *tables[] = {&classes, &methods, &params, &strings};
+
+    for (uint32_t i=0; i<4; i++)
+        if (tables[i]->data)
+            IOFree(tables[i]->data, tables[i]->cap);
+}
+
+bool MOFSchemaBuilder::append(mof_table *t, const void *data, uint32_t len) {
+    uint32_t cap = t->cap ? t->cap : 256;
+    uint8_t *grown;
+
+    while (cap - t->len < len) {
+        if (cap > 0x1000000)
+            return false;
+        cap *= 2;
+    }
+    if (cap != t->cap) {
+        grown = (uint8_t *)IOMalloc(cap);
+        if (!grown)
+            return false;
+        if (t->data) {
+            memcpy(grown, t->data, t->len);
+            IOFree(t->data, t->cap);
+        }
+        t->data = grown;
+        t->cap = cap;
+    }
+    memcpy(t->data + t->len, data, len);
+    t->len += len;
+    return true;
+}
+
+// Offset of a copy of s in the string table, 0 on error
+uint32_t MOFSchemaBuilder::string(const char *s) {
+    uint32_t offset = strings.len;
+
+    if (!s[0])
+        return 0;
+    if (!append(&strings, s, (uint32_t)strlen(s) + 1)) {
+        ok = false;
+        return 0;
+    }
+    return offset;
+}
+
+uint32_t MOFSchemaBuilder::string(uint32_t offset, uint32_t len) {
+    char buf[256];
+
+    if (source->getString(offset, len, buf, sizeof(buf)) >= sizeof(buf)) {
+        ok = false;
+        return 0;
+    }
+    return string(buf);
+}
+
+bool MOFSchemaBuilder::add(MOF *mof, uint32_t i, int notify) {
+    const char *guid = mof->getClassGUID(i);
+    mof_schema_class c = {};
+
+    // only classes with a GUID are looked up
+    if (!guid || !guid[0])
+        return ok;
+    if (classes.len / sizeof(c) >= 0xFFFF) {
+        ok = false;
+        return ok;
+    }
+    c.guid = string(guid);
+    c.method = methods.len / sizeof(mof_schema_method);
+    if (notify >= 0) {
+        c.notify = (uint8_t)notify;
+        c.flags = MOF_SCHEMA_NOTIFY;
+    }
+    if (!append(&classes, &c, sizeof(c)))
+        ok = false;
+    if (ok)
+        mof->visitClassAt(i, this);
+    return ok;
+}
+
+// The class and the parameter classes of its methods
+int MOFSchemaBuilder::beginClass(const mof_node *node) {
+    return depth == 1 || depth == 3 ? MOF_VISIT_CONTINUE : MOF_VISIT_SKIP;
+}
+
+// Qualifiers of a method, the class ones are not needed
+int MOFSchemaBuilder::qualifier(const mof_node *node) {
+    if (depth == 3 && source->nameEquals(node, "WmiMethodId"))
+        mof_int(node, &((mof_schema_method *)methods.data)[method_index].id);
+    return MOF_VISIT_SKIP;
+}
+
+int MOFSchemaBuilder::property(const mof_node *node) {
+    mof_schema_param p = {};
+    uint32_t name, id;
+
+    if (depth == 2 && source->nameEquals(node, "__CLASS") && node->kind == MOF_NODE_VALUE &&
+        node->type == MOF_STRING && !node->flags) {
+        name = string(node->value.span.offset, node->value.span.len);
+        ((mof_schema_class *)classes.data)[classes.len / sizeof(mof_schema_class) - 1].name = name;
+    }
+    if (depth != 4 || (node->nlen >= 2 && source->read16(node->name) == '_'))
+        return ok ? MOF_VISIT_SKIP : MOF_VISIT_STOP;
+
+    // a parameter of the method being added
+    p.name = string(node->name, node->nlen);
+    p.id = mof_int(source->findChild(node, "ID", MOF_ROLE_QUALIFIER), &id) && id < 0xFFFF ? (uint16_t)id : 0xFFFF;
+    p.type = node->type;
+    if (mof_qualifier_true(source, node, "in"))
+        p.flags |= MOF_SCHEMA_IN;
+    if (mof_qualifier_true(source, node, "out"))
+        p.flags |= MOF_SCHEMA_OUT;
+    if (node->flags & MOF_NODE_ARRAY)
+        p.flags |= MOF_SCHEMA_ARRAY;
+    if (!append(&params, &p, sizeof(p)))
+        ok = false;
+    ((mof_schema_method *)methods.data)[method_index].params++;
+    return ok ? MOF_VISIT_SKIP : MOF_VISIT_STOP;
+}
+
+int MOFSchemaBuilder::method(const mof_node *node) {
+    mof_schema_method m = {};
+
+    if (depth != 2 || !with_methods)
+        return MOF_VISIT_SKIP;
+    if (methods.len / sizeof(m) >= 0xFFFF) {
+        ok = false;
+        return MOF_VISIT_STOP;
+    }
+    m.name = string(node->name, node->nlen);
+    m.id = MOF_SCHEMA_NO_ID;
+    m.param = params.len / sizeof(mof_schema_param);
+    method_index = methods.len / sizeof(m);
+    if (!append(&methods, &m, sizeof(m))) {
+        ok = false;
+        return MOF_VISIT_STOP;
+    }
+    ((mof_schema_class *)classes.data)[classes.len / sizeof(mof_schema_class) - 1].methods++;
+    return MOF_VISIT_CONTINUE;
+}
+
+OSData* MOFSchemaBuilder::finish(uint64_t key, uint32_t length) {
+    mof_table *tables[] = {&classes, &methods, &params, &strings};
+    mof_schema_header hdr = {};
+    OSData *data;
+    uint8_t *buf, *p;
+
+    if (!ok)
+        return nullptr;
+    hdr.magic = MOF_SCHEMA_MAGIC;
+    hdr.version = MOF_SCHEMA_VERSION;
+    hdr.header = sizeof(hdr);
+    hdr.key = key;
+    hdr.length = length;
+    hdr.size = sizeof(hdr) + classes.len + methods.len + params.len + strings.len;
+    hdr.classes = classes.len / sizeof(mof_schema_class);
+    hdr.methods = methods.len / sizeof(mof_schema_method);
+    hdr.params = params.len / sizeof(mof_schema_param);
+    hdr.strings = strings.len;
+
+    buf = (uint8_t *)IOMalloc(hdr.size);
+    if (!buf)
+        return nullptr;
+    p = buf + sizeof(hdr);
+    for (uint32_t i=0; i<4; i++) {
+        // empty tables have no data yet
+        if (tables[i]->len)
+            memcpy(p, tables[i]->data, tables[i]->len);
+        p += tables[i]->len;
+    }
+    hdr.check = (uint32_t)mof_hash(buf + sizeof(hdr), hdr.size - sizeof(hdr));
+    memcpy(buf, &hdr, sizeof(hdr));
+    data = OSData::withBytes(buf, hdr.size);
+    IOFree(buf, hdr.size);
+    return data;
+}
+
+MOFSchema* MOFSchema::withData(OSData *data, uint64_t key, uint32_t length) {
+    MOFSchema *schema;
+
+    if (!data)
+        return nullptr;
+    schema = new MOFSchema;
+    if (!schema)
+        return nullptr;
+    schema->data = data;
+    data->retain();
+    if (!schema->check(key, length)) {
+        delete schema;
+        return nullptr;
+    }
+    return schema;
+}
+
+MOFSchema::~MOFSchema() {
+    OSSafeReleaseNULL(data);
+}
+
+// Stored data may be stale or damaged, every offset is checked here
+bool MOFSchema::check(uint64_t key, uint32_t length) {
+    const uint8_t *buf = (const uint8_t *)data->getBytesNoCopy();
+    uint32_t size = data->getLength();
+    uint64_t tables;
+
+    if (size < sizeof(mof_schema_header))
+        return false;
+    hdr = (const mof_schema_header *)buf;
+    if (hdr->magic != MOF_SCHEMA_MAGIC || hdr->version != MOF_SCHEMA_VERSION ||
+        hdr->header != sizeof(mof_schema_header) || hdr->key != key || hdr->length != length ||
+        hdr->size != size)
+        return false;
+    tables = (uint64_t)hdr->classes * sizeof(mof_schema_class) +
+             (uint64_t)hdr->methods * sizeof(mof_schema_method) +
+             (uint64_t)hdr->params * sizeof(mof_schema_param);
+    if (hdr->strings == 0 || sizeof(mof_schema_header) + tables + hdr->strings != size)
+        return false;
+    if (hdr->check != (uint32_t)mof_hash(buf + sizeof(mof_schema_header), size - sizeof(mof_schema_header)))
+        return false;
+
+    classes = (const mof_schema_class *)(buf + sizeof(mof_schema_header));
+    methods = (const mof_schema_method *)(classes + hdr->classes);
+    params = (const mof_schema_param *)(methods + hdr->methods);
+    strings = (const char *)(params + hdr->params);
+    if (strings[hdr->strings - 1])
+        return false;
+    for (uint32_t i=0; i<hdr->classes; i++)
+        if (classes[i].guid >= hdr->strings || classes[i].name >= hdr->strings ||
+            (uint32_t)classes[i].method + classes[i].methods > hdr->methods)
+            return false;
+    for (uint32_t i=0; i<hdr->methods; i++)
+        if (methods[i].name >= hdr->strings || (uint64_t)methods[i].param + methods[i].params > hdr->params)
+            return false;
+    for (uint32_t i=0; i<hdr->params; i++)
+        if (params[i].name >= hdr->strings)
+            return false;
+    return true;
+}
+
+const mof_schema_class *MOFSchema::getClass(const char *guid) {
+    for (uint32_t i=0; i<hdr->classes; i++)
+        if (!strcmp(strings + classes[i].guid, guid))
+            return &classes[i];
+    return nullptr;
+}
+
+const mof_schema_method *MOFSchema::getMethodNamed(const mof_schema_class *c, const char *name) {
+    for (uint32_t i=0; i<c->methods; i++)
+        if (!strcmp(strings + methods[c->method + i].name, name))
+            return &methods[c->method + i];
+    return nullptr;
+}
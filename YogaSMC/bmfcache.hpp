@@ -0,0 +1,164 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfcache.hpp
+//  YogaSMC
+//
+//  Compiled schema of a BMF, kept between starts, see MOFSchema.
+//
+
+#ifndef bmfcache_hpp
+#define bmfcache_hpp
+
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
+#include "bmfvisitor.hpp"
+
+#define MOF_SCHEMA_MAGIC 0x534D4F4D     // "MOMS"
+#define MOF_SCHEMA_VERSION 1
+
+class MOF;
+
+// Hash of a raw WQxx buffer, not cryptographic
+uint64_t mof_hash(const void *buf, uint32_t len);
+
+/*
+ * Little endian, the header is followed by the class, method and
+ * parameter tables and a string table. Strings are offsets into the
+ * string table, which starts with an empty string.
+ */
+struct mof_schema_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header;            // bytes of this header
+    uint64_t key;               // mof_hash of the WQxx buffer
+    uint32_t length;            // bytes of the WQxx buffer
+    uint32_t size;              // bytes of the whole schema
+    uint32_t check;             // mof_hash of what follows the header, low half
+    uint16_t classes;
+    uint16_t methods;
+    uint32_t params;
+    uint32_t strings;           // bytes of the string table
+};
+
+enum {
+    MOF_SCHEMA_NOTIFY = 0x1,    // notify is the notify-id of the GUID in _WDG
+};
+
+struct mof_schema_class {
+    uint32_t guid;              // lower case, as in _WDG
+    uint32_t name;              // __CLASS
+    uint16_t method;            // first method
+    uint16_t methods;
+    uint8_t notify;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+#define MOF_SCHEMA_NO_ID 0xFFFFFFFF
+
+struct mof_schema_method {
+    uint32_t name;
+    uint32_t id;                // WmiMethodId, MOF_SCHEMA_NO_ID without one
+    uint32_t param;             // first parameter
+    uint32_t params;
+};
+
+enum {
+    MOF_SCHEMA_IN = 0x1,
+    MOF_SCHEMA_OUT = 0x2,
+    MOF_SCHEMA_ARRAY = 0x4,
+};
+
+struct mof_schema_param {
+    uint32_t name;
+    uint16_t id;                // ID qualifier, 0xFFFF without one
+    uint8_t type;               // mof_data_type
+    uint8_t flags;
+};
+
+// Table being written, grows on the heap
+struct mof_table {
+    uint8_t *data;
+    uint32_t len;
+    uint32_t cap;
+};
+
+/*
+ * Compiles the GUID classes of a lazy MOF, one visitClassAt per class.
+ * Names, method IDs and parameters are all the drivers look up, so a
+ * schema is a fraction of the MOF it came from.
+ */
+class MOFSchemaBuilder : public MOFVisitor {
+
+public:
+    // Without methods only the GUID, __CLASS and notify-id of each class are kept
+    MOFSchemaBuilder(bool methods = true);
+    ~MOFSchemaBuilder();
+
+    // Class i of mof, notify < 0 without a notify-id, false on error
+    bool add(MOF *mof, uint32_t i, int notify);
+    // Schema of the classes added, nullptr on error
+    OSData* finish(uint64_t key, uint32_t length);
+
+private:
+    virtual int beginClass(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int qualifier(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int property(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int method(const mof_node *node) APPLE_KEXT_OVERRIDE;
+
+    bool append(mof_table *t, const void *data, uint32_t len);
+    uint32_t string(uint32_t offset, uint32_t len);
+    uint32_t string(const char *s);
+
+    mof_table classes {};
+    mof_table methods {};
+    mof_table params {};
+    mof_table strings {};
+    uint32_t method_index {0};          // method being added, tables move as they grow
+    bool with_methods;
+    bool ok {true};
+};
+
+/*
+ * Read side of a schema. The data is checked once by withData, lookups
+ * trust it afterwards.
+ */
+class MOFSchema {
+
+public:
+    // nullptr unless data is a schema of this version for key and length
+    static MOFSchema* withData(OSData *data, uint64_t key, uint32_t length);
+    ~MOFSchema();
+
+    uint32_t getClassCount() {return hdr->classes;};
+    const mof_schema_class *getClassAt(uint32_t i) {return i < hdr->classes ? &classes[i] : nullptr;};
+    const mof_schema_class *getClass(const char *guid);
+    const mof_schema_method *getMethod(const mof_schema_class *c, uint32_t i) {return i < c->methods ? &methods[c->method + i] : nullptr;};
+    const mof_schema_method *getMethodNamed(const mof_schema_class *c, const char *name);
+    const mof_schema_param *getParam(const mof_schema_method *m, uint32_t i) {return i < m->params ? &params[m->param + i] : nullptr;};
+    const char *getString(uint32_t offset) {return strings + offset;};
+    uint32_t getSize() {return hdr->size;};
+
+private:
+    MOFSchema() {};
+    bool check(uint64_t key, uint32_t length);
+
+    OSData *data {nullptr};
+    const mof_schema_header *hdr {nullptr};
+    const mof_schema_class *classes {nullptr};
+    const mof_schema_method *methods {nullptr};
+    const mof_schema_param *params {nullptr};
+    const char *strings {nullptr};
+};
+
+// Where schemas are kept between starts, keyed by mof_hash
+class MOFCacheStore {
+
+public:
+    virtual ~MOFCacheStore() {};
+
+    // Schema stored for key, nullptr without one, released by the caller
+    virtual OSData* load(uint64_t key) = 0;
+    virtual bool store(uint64_t key, OSData *data) = 0;
+};
+
+#endif /* bmfcache_hpp */
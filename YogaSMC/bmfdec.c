@@ -26,10 +26,7 @@
 #include <IOKit/IOLib.h>
 
 #define INLINE static inline
-
-typedef uint8_t __u8;
-typedef uint32_t __u32;
-typedef uint16_t __u16;
+#define INLINE_ALWAYS static inline __attribute__((always_inline))
 
 #ifdef DEBUG
 #define LOG_DECOMP(...) do { IOLog("YogaBMF: " __VA_ARGS__); } while (0)
@@ -38,6 +35,8 @@ typedef uint16_t __u16;
 #define LOG_DECOMP(...)
 #endif
 
+#include "bmfdec_core.h"
+
 /*
 dblspace_dec.c
 
@@ -185,11 +184,11 @@ INLINE int dblb_decrep(bits_t *pbits, __u8 **p, void *pout, __u8 *pend,
   return 0;
 }
 
-/* DS decompression */
+/* DS decompression, reference decoder */
 /* flg=0x4000 is used, when called from stacker_dec.c, because of
    stacker does not store original cluster size and it can mean,
    that last cluster in file can be ended by garbage */
-int ds_dec(void* pin,int lin, void* pout, int lout, int flg)
+int ds_dec_ref(void* pin,int lin, void* pout, int lout, int flg)
 { 
   __u8 *p, *pend;
   unsigned u, repoffs;
@@ -244,6 +243,223 @@ int ds_dec(void* pin,int lin, void* pout, int lout, int flg)
   return (int)(p-(__u8*)pout);
 }
 
+/* token tables of the table-driven decoder, see bmfdec_core.h */
+#define DBLB_X4(T,i)   T(i),T((i)+1),T((i)+2),T((i)+3)
+#define DBLB_X16(T,i)  DBLB_X4(T,i),DBLB_X4(T,(i)+4),DBLB_X4(T,(i)+8),DBLB_X4(T,(i)+12)
+#define DBLB_X64(T,i)  DBLB_X16(T,i),DBLB_X16(T,(i)+16),DBLB_X16(T,(i)+32),DBLB_X16(T,(i)+48)
+#define DBLB_X512(T)   DBLB_X64(T,0),DBLB_X64(T,64),DBLB_X64(T,128),DBLB_X64(T,192), \
+                       DBLB_X64(T,256),DBLB_X64(T,320),DBLB_X64(T,384),DBLB_X64(T,448)
+
+/* token: 01/10 literal, 00 6-bit offset, 011 8-bit offset+64, 111 12-bit offset+320 */
+#define DBLB_TOK(i) \
+   { ((i)&3)==1 ? ((i)>>2)|128 : ((i)&3)==2 ? ((i)>>2)&127 : \
+     ((i)&3)==0 ? 0 : ((i)&7)==3 ? 64 : 320, \
+     ((i)&3)==1 || ((i)&3)==2 ? DBLB_LIT : DBLB_REP, \
+     ((i)&3)==1 || ((i)&3)==2 ? 9 : ((i)&3)==0 ? 2 : 3, \
+     ((i)&3)==1 || ((i)&3)==2 ? 0 : ((i)&3)==0 ? 6 : ((i)&7)==3 ? 8 : 12 }
+
+/* length: n zero bits and a one, followed by n bits added to (1<<n)+2 */
+#define DBLB_CTZ(i) \
+   ((i)&1?0:(i)&2?1:(i)&4?2:(i)&8?3:(i)&16?4:(i)&32?5:(i)&64?6:(i)&128?7:8)
+#define DBLB_LEN(i) \
+   { (1<<DBLB_CTZ(i))+2, (i) ? DBLB_REP : DBLB_BAD, \
+     DBLB_CTZ(i)+1, DBLB_CTZ(i) }
+
+const dblb_tab_t dblb_tok[512]={DBLB_X512(DBLB_TOK)};
+const dblb_tab_t dblb_len[512]={DBLB_X512(DBLB_LEN)};
+
+/*
+ * literal run: number of leading literals among the next three 9-bit
+ * slots, indexed by the 2-bit code of each slot (bits 0-1, 9-10, 18-19)
+ */
+#define DBLB_ISLIT(c) ((((c)^((c)>>1))&1))
+#define DBLB_LRUN(i) \
+   (!DBLB_ISLIT(i) ? 0 : !DBLB_ISLIT((i)>>2) ? 1 : !DBLB_ISLIT((i)>>4) ? 2 : 3)
+
+const __u8 dblb_lrun[64]={DBLB_X64(DBLB_LRUN,0)};
+
+/* DS decompression */
+int ds_dec(void* pin,int lin, void* pout, int lout, int flg)
+{
+  ds_dec_t s;
+  int r;
+
+  if((r=dblq_start(&s,pin,lin,lout,flg))<0) return r;
+  return dblq_run(&s,(__u8*)pout,lout,DBLQ_STORE,NULL,NULL,NULL);
+}
+
+/* DS validation, nothing is written */
+int ds_probe(void* pin,int lin, int lout, int flg, ds_count_t *cnt)
+{
+  ds_dec_t s;
+  ds_count_t c;
+  int r;
+
+  memset(&c,0,sizeof(c));
+  if((r=dblq_start(&s,pin,lin,lout,flg))>=0)
+    r=dblq_run(&s,NULL,lout,DBLQ_COUNT,&c,NULL,NULL);
+  if(cnt) *cnt=c;
+  return r;
+}
+
+/* resumable DS decompression through a sliding window, see bmfdec.h */
+
+#define DS_WMASK (DS_WINDOW-1)
+
+int ds_stream_init(ds_stream_t *s, int lout, int flg)
+{
+  if(lout<0) return -1;
+  memset(&s->bits,0,sizeof(s->bits));
+  s->inbase=0;
+  s->last=0;
+  s->wr=s->rd=0;
+  s->lout=lout;
+  s->flg=flg;
+  s->state=DS_ST_HEADER;
+  s->err=0;
+  return 0;
+}
+
+void ds_stream_feed(ds_stream_t *s, const void *pin, int lin, int last)
+{
+  /* previous chunk is fully loaded into the reservoir at this point */
+  s->inbase+=(int)(s->bits.pd-s->bits.ps);
+  s->bits.ps=s->bits.pd=(__u8*)pin;
+  s->bits.pe=s->bits.pd+lin;
+  s->last=last;
+}
+
+/* makes n bits available, 0 if more input is needed */
+INLINE int ds_stream_need(ds_stream_t *s, int n)
+{
+  if(s->bits.cnt>=n) return 1;
+  dblq_load(&s->bits);
+  if(s->bits.cnt>=n) return 1;
+  if(!s->last) return 0;
+  dblq_fill(&s->bits);
+  return 1;
+}
+
+INLINE int ds_stream_rep(ds_stream_t *s, unsigned repoffs)
+{ int replen;
+  unsigned w, r;
+
+  if(repoffs==0){LOG_DECOMP("DMSDOS: decrb: zero offset ?\n");return -2;}
+  if(repoffs==0x113f)
+  {
+    LOG_DECOMP("DMSDOS: decrb: 0x113f sync found.\n");
+    if((s->wr%512) && !(s->flg&0x4000))
+    { LOG_DECOMP("DMSDOS: decrb: sync at decompressed pos %d ?\n",s->wr);
+      return -2;
+    }
+    return 0;
+  }
+  replen=dblq_rdlen(&s->bits)-1;
+
+  if(replen<=0)
+    {LOG_DECOMP("DMSDOS: decrb: illegal count ?\n");return -2;}
+  if(repoffs>(unsigned)s->wr)
+    {LOG_DECOMP("DMSDOS: decrb: of>pos ?\n");return -2;}
+  if(s->wr+replen>s->lout)
+    {LOG_DECOMP("DMSDOS: decrb: output overfill ?\n");return -2;}
+  w=s->wr;
+  r=w-repoffs;
+  s->wr+=replen;
+  for(;replen;replen--)
+    s->win[(w++)&DS_WMASK]=s->win[(r++)&DS_WMASK];
+  return 0;
+}
+
+/* decodes into the window until it is full, input runs out or the stream ends */
+static int ds_stream_run(ds_stream_t *s)
+{
+  unsigned u, v;
+  const dblb_tab_t *t;
+  int r, lim;
+
+  switch(s->state)
+  {
+    case DS_ST_HEADER:
+      if(!ds_stream_need(s,32)) return 0;
+      if((dblq_rdn(&s->bits,16))!=0x5344) return -1;
+      u=dblq_rdn(&s->bits,16);
+      u=((u&0xff)<<8)|((u>>8)&0xff);
+      LOG_DECOMP("DMSDOS: DS decompression version %d\n",u);
+      s->state=DS_ST_DATA;
+      /* fall through */
+
+    case DS_ST_DATA:
+      for(;;)
+      {
+        if(s->wr>=s->lout) break;
+        if(s->last)
+        { /* the last 16-bit word is left for the final sync */
+          lim=(((s->inbase+(int)(s->bits.pe-s->bits.ps)+1)>>1)-1)*16;
+          if(s->inbase*8+DBLQ_POS(s->bits)>=lim) break;
+        }
+        /* room for the longest match */
+        if(s->wr-s->rd>DS_WINDOW-512) return 0;
+        /* a whole token is at most 15+17 bits */
+        if(!ds_stream_need(s,32)) return 0;
+        u=(unsigned)s->bits.buf;
+        t=&dblb_tok[u&511];
+        v=t->base+((u>>t->nb)&dblb_bmsk[t->xb]);
+        DBLQ_SKIP(s->bits,t->nb+t->xb);
+        if(t->kind==DBLB_LIT)
+          s->win[(s->wr++)&DS_WMASK]=v;
+        else if((r=ds_stream_rep(s,v))<0)
+          return r;
+      }
+      s->state=DS_ST_SYNC;
+      /* fall through */
+
+    case DS_ST_SYNC:
+      if(!(s->flg&0x4000))
+      {
+        if(!ds_stream_need(s,15)) return 0;
+        u=dblq_rdn(&s->bits,3);if(u==7) u=dblq_rdn(&s->bits,12)+320;
+        if(u!=0x113f)
+        { LOG_DECOMP("DMSDOS: decrb: final sync not found?\n");
+          return -2;
+        }
+      }
+      s->state=DS_ST_END;
+      /* fall through */
+
+    case DS_ST_END:
+      return 0;
+  }
+  return s->err; /* DS_ST_ERROR */
+}
+
+int ds_stream_drain(ds_stream_t *s, void *pout, int lout)
+{
+  __u8 *p=(__u8*)pout;
+  int n=0, k, r;
+
+  if(s->state==DS_ST_ERROR) return s->err;
+  for(;;)
+  {
+    k=s->wr-s->rd;
+    if(k>lout-n) k=lout-n;
+    if(k>0)
+    { int o=s->rd&DS_WMASK;
+      int c=(k>DS_WINDOW-o)?DS_WINDOW-o:k;
+      memcpy(p+n,s->win+o,c);
+      memcpy(p+n+c,s->win,k-c);
+      s->rd+=k;
+      n+=k;
+    }
+    if(n==lout||s->state==DS_ST_END) return n;
+    if((r=ds_stream_run(s))<0)
+    { s->state=DS_ST_ERROR;
+      s->err=r;
+      return r;
+    }
+    if(s->wr==s->rd) return n;
+  }
+}
+
 /*
  * BMF file is compressed by DS-01 algorithm with additional header:
  * 4 bytes: 46 4f 4d 42 - 'F' 'O' 'M' 'B'
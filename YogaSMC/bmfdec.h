@@ -9,14 +9,212 @@
 #ifndef bmfdec_h
 #define bmfdec_h
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int ds_dec(void* pin,int lin, void* pout, int lout, int flg);
+// Branchy reference decoder, same contract as ds_dec
+int ds_dec_ref(void* pin,int lin, void* pout, int lout, int flg);
+
+// Bit reservoir of the DS decoder
+typedef struct {
+    uint64_t buf;   // bit buffer, next bit is bit 0
+    int cnt;        // valid bits in buf
+    uint8_t *pd;    // first not loaded input byte
+    uint8_t *pe;    // after end of data
+    uint8_t *ps;    // start of data
+    int pz;         // zero bytes loaded after end of data
+} ds_bits_t;
+
+enum {
+    DS_ST_HEADER,
+    DS_ST_DATA,
+    DS_ST_SYNC,
+    DS_ST_END,
+    DS_ST_ERROR
+};
+
+// Token statistics collected by ds_probe
+typedef struct {
+    uint32_t lits;      // literal bytes
+    uint32_t reps;      // back-references
+    uint32_t repbytes;  // bytes produced by back-references
+    uint32_t syncs;     // 0x113f sync markers inside the data
+} ds_count_t;
+
+// State of dblq_run over a flat output buffer, kept by ds::Decoder between runs
+typedef struct {
+    ds_bits_t bits;
+    int lim;        // input bits before the final sync word
+    int pos;        // bytes decoded
+    int lout;       // size of the output buffer
+    int flg;
+    int state;      // DS_ST_DATA, DS_ST_END or DS_ST_ERROR
+} ds_dec_t;
+
+/*
+ * Walks the bitstream without writing any output, returns exactly what
+ * ds_dec would return for an output buffer of lout bytes.
+ * cnt may be NULL, otherwise it receives the token counts.
+ */
+int ds_probe(void* pin,int lin, int lout, int flg, ds_count_t *cnt);
+
+// History window, must hold the largest offset (0x113e) plus a full match
+#define DS_WINDOW 8192
+
+// Resumable decoder state, about 8 KiB so keep it off the kernel stack
+typedef struct {
+    ds_bits_t bits;
+    int inbase;     // input bytes of previous chunks
+    int last;       // current chunk ends the stream
+    int wr;         // bytes decoded
+    int rd;         // bytes drained
+    int lout;       // declared decompressed size
+    int flg;
+    int state;
+    int err;
+    uint8_t win[DS_WINDOW];
+} ds_stream_t;
+
+/*
+ * Usage:
+ *   ds_stream_init(s, lout, flg);
+ *   ds_stream_feed(s, chunk, len, is_last);
+ *   while ((n = ds_stream_drain(s, buf, sizeof(buf))) > 0) consume(buf, n);
+ * A return of 0 means either s->state == DS_ST_END or the current chunk is
+ * used up and the next one should be fed; negative values are errors as in
+ * ds_dec. A chunk must stay valid until drain asks for the next one.
+ */
+int ds_stream_init(ds_stream_t *s, int lout, int flg);
+void ds_stream_feed(ds_stream_t *s, const void *pin, int lin, int last);
+int ds_stream_drain(ds_stream_t *s, void *pout, int lout);
 
 #ifdef __cplusplus
 }
+
+#include "bmfdec_core.h"
+
+/*
+ * C++ front-end of the table-driven decoder, specialised at compile time
+ * on the flag policy and the output sink:
+ *   ds::BufferSink sink(pout);
+ *   ds::decode<ds::Strict>(pin, lin, lout, sink);
+ * or resumable:
+ *   ds::Decoder<ds::Strict, ds::HashSink> d;
+ *   d.init(pin, lin, lout);
+ *   d.run(sink, upto);  // repeat with a larger upto later
+ * run returns the number of valid output bytes, which is at least upto
+ * unless the data ends first (then d.s.state == DS_ST_END and the final
+ * sync has been checked), or a negative error. A token is never split, so
+ * the result may be up to 511 bytes past upto. pin and the sink's output
+ * must stay the same between calls.
+ * Results are the same as ds_dec with the policy's flg.
+ */
+namespace ds {
+
+// Flag policies, see flg of ds_dec
+struct Strict {
+    enum { flg = 0 };
+};
+
+// Sync markers anywhere, no final sync (stacker clusters)
+struct Lenient {
+    enum { flg = 0x4000 };
+};
+
+/*
+ * Sinks get marker() at each inner sync and flush() when run returns;
+ * out[0, pos) is final at both. Sinks with stores set get the data
+ * written to out, which needs the full lout bytes. counts() is where
+ * token counts go, nullptr for none.
+ */
+struct BufferSink {
+    enum { stores = 1 };
+    uint8_t *out;
+
+    BufferSink(void *out) : out((uint8_t *)out) {}
+    ds_count_t *counts() { return nullptr; }
+    void marker(int) {}
+    void flush(int) {}
+};
+
+// Nothing is written, counts tokens like ds_probe
+struct CountSink {
+    enum { stores = 0 };
+    uint8_t *out {nullptr};
+    ds_count_t cnt {};
+
+    ds_count_t *counts() { return &cnt; }
+    void marker(int) {}
+    void flush(int) {}
+};
+
+// 64-bit FNV-1a of the output, updated a sync block at a time while it is still in cache
+struct HashSink : BufferSink {
+    uint64_t hash {0xcbf29ce484222325ULL};
+    int done {0};
+
+    HashSink(void *out) : BufferSink(out) {}
+    void marker(int pos) { flush(pos); }
+    void flush(int pos) {
+        for (; done < pos; done++)
+            hash = (hash ^ out[done]) * 0x100000001b3ULL;
+    }
+};
+
+// Hands every finished block to P::feed(const uint8_t *data, int len)
+template <class P>
+struct FeedSink : BufferSink {
+    P &parser;
+    int done {0};
+
+    FeedSink(void *out, P &parser) : BufferSink(out), parser(parser) {}
+    void marker(int pos) { flush(pos); }
+    void flush(int pos) {
+        if (pos > done) {
+            parser.feed(out + done, pos - done);
+            done = pos;
+        }
+    }
+};
+
+template <class Flags, class Sink>
+class Decoder {
+public:
+    ds_dec_t s;
+
+    int init(void *pin, int lin, int lout) { return dblq_start(&s, pin, lin, lout, Flags::flg); }
+    int run(Sink &sink, int stop);
+
+private:
+    static void mark(void *sink, int pos) { ((Sink *)sink)->marker(pos); }
+};
+
+// Decodes up to output offset stop; the loop is dblq_run of ds_dec
+template <class Flags, class Sink>
+inline int Decoder<Flags, Sink>::run(Sink &sink, int stop) {
+    int r = dblq_run(&s, sink.out, stop, Sink::stores ? DBLQ_STORE : DBLQ_COUNT, sink.counts(), mark, &sink);
+
+    if (r >= 0)
+        sink.flush(r);
+    return r;
+}
+
+// One-shot decode, same result as ds_dec(pin, lin, sink.out, lout, Flags::flg)
+template <class Flags, class Sink>
+inline int decode(void *pin, int lin, int lout, Sink &sink) {
+    Decoder<Flags, Sink> d;
+    int r;
+
+    if ((r = d.init(pin, lin, lout)) < 0)
+        return r;
+    return d.run(sink, lout);
+}
+
+} // namespace ds
 #endif
 
 #endif /* bmfdec_h */
@@ -0,0 +1,360 @@
+/*
+    bmfdec_core.h - Table-driven DS decoding primitives
+    Copyright (C) 2017  Pali Rohár <pali.rohar@gmail.com>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; version 2.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * Shared by ds_dec() in bmfdec.c and the C++ front-end in bmfdec.h,
+ * not meant to be included on its own. The decoding loop is dblq_run(),
+ * both expand it with their own sink.
+ */
+
+#ifndef bmfdec_core_h
+#define bmfdec_core_h
+
+#include <string.h>
+
+#if !defined(LOG_DECOMP)
+    #define LOG_DECOMP(...)
+#endif
+
+typedef uint8_t __u8;
+typedef uint32_t __u32;
+typedef uint16_t __u16;
+typedef uint64_t __u64;
+
+#if !defined(le64_to_cpu)
+    #define le64_to_cpu(v) (v)
+#endif
+
+/* table-driven token decoding */
+#define DBLB_LIT 0	/* literal byte */
+#define DBLB_REP 1	/* back-reference offset or length */
+#define DBLB_BAD 2	/* invalid code */
+
+/*
+ * Both tables are indexed by the next 9 bits of the stream.
+ * value = base + next xb bits after the nb bits of the code,
+ * the token consumes nb+xb bits.
+ */
+typedef
+ struct {
+   __u16 base;	/* literal byte, offset base or length base */
+   __u8 kind;	/* DBLB_LIT, DBLB_REP or DBLB_BAD */
+   __u8 nb:4;	/* bits of the code itself */
+   __u8 xb:4;	/* extra bits following the code */
+ } dblb_tab_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* defined in bmfdec.c */
+extern const unsigned dblb_bmsk[];
+extern const dblb_tab_t dblb_tok[512];
+extern const dblb_tab_t dblb_len[512];
+extern const __u8 dblb_lrun[64];
+
+#ifdef __cplusplus
+}
+#endif
+
+/* dblb_lrun index of the 2-bit codes of the next three 9-bit slots */
+#define DBLB_LRIX(u) (((u)&3)|(((u)>>7)&12)|(((u)>>14)&48))
+
+/* 64-bit bit reservoir for the table-driven decoder */
+typedef ds_bits_t bits64_t;
+
+/* unaligned little-endian load of 8 input bytes */
+static inline __u64 dblq_ld64(const __u8 *pd)
+{ __u64 v;
+  memcpy(&v,pd,sizeof(v));
+  return le64_to_cpu(v);
+}
+
+/* tops the reservoir up from the available input only */
+static inline void dblq_load(bits64_t *pbits)
+{
+  if(pbits->pe-pbits->pd>=8)
+  { /* bits above cnt are rewritten with the same data next time */
+    pbits->buf|=dblq_ld64(pbits->pd)<<pbits->cnt;
+    pbits->pd+=(63-pbits->cnt)>>3;
+    pbits->cnt|=56;
+    return;
+  }
+  while(pbits->cnt<=56&&pbits->pd<pbits->pe)
+  { pbits->buf|=((__u64)*(pbits->pd++))<<pbits->cnt;
+    pbits->cnt+=8;
+  }
+}
+
+/* tops the reservoir up to at least 56 bits, zeros after end of data */
+static inline void dblq_fill(bits64_t *pbits)
+{
+  dblq_load(pbits);
+  if(pbits->pd<pbits->pe) return;
+  while(pbits->cnt<=56)
+  { pbits->pz++;
+    pbits->cnt+=8;
+  }
+}
+
+/* bits already consumed from the stream */
+#define DBLQ_POS(bits) \
+   ((int)(((bits).pd-(bits).ps+(bits).pz)<<3)-(bits).cnt)
+
+#define DBLQ_SKIP(bits,n) \
+   { \
+    (bits).buf>>=(n); \
+    (bits).cnt-=(n); \
+   }
+
+/* initializes reading from bitstream */
+static inline void dblq_rdi(bits64_t *pbits,void *pin,unsigned lin)
+{
+  pbits->buf=0;
+  pbits->cnt=0;
+  pbits->pz=0;
+  pbits->ps=pbits->pd=(__u8*)pin;
+  pbits->pe=pbits->pd+lin;
+  dblq_fill(pbits);
+}
+
+/* reads n<=32 bits from bitstream *pbits */
+static inline unsigned dblq_rdn(bits64_t *pbits,int n)
+{
+  unsigned u;
+  if(pbits->cnt<n) dblq_fill(pbits);
+  u=(unsigned)pbits->buf&(unsigned)((1ull<<n)-1);
+  DBLQ_SKIP(*pbits,n);
+  return u;
+}
+
+/* caller guarantees 17 bits in the reservoir */
+static inline int dblq_rdlen(bits64_t *pbits)
+{ unsigned u;
+  const dblb_tab_t *t;
+  u=(unsigned)pbits->buf;
+  t=&dblb_len[u&511];
+  if(t->kind==DBLB_BAD) return -1;
+  DBLQ_SKIP(*pbits,t->nb+t->xb);
+  return t->base+((u>>t->nb)&dblb_bmsk[t->xb]);
+}
+
+/* longest match and the slack written past it by block copies */
+#define DBLQ_MAXREP 512
+#define DBLQ_SLACK 15
+
+/*
+ * copies a back-reference of len bytes from off bytes behind p,
+ * with slack block copies may write up to DBLQ_SLACK bytes past the match
+ */
+static inline void dblq_copy(__u8 *p, unsigned off, int len, int slack)
+{ __u8 *r=p-off;
+  int n;
+
+  if(off==1)
+  { memset(p,*r,len);
+    return;
+  }
+  if(off>=8 && slack)
+  { if(off>=16)
+      do { memcpy(p,r,16); p+=16; r+=16; len-=16; } while(len>0);
+    else
+      do { memcpy(p,r,8); p+=8; r+=8; len-=8; } while(len>0);
+    return;
+  }
+  if(off<8 && len>=16)
+  { /* seed one period, then double the periodic run */
+    for(n=0;n<(int)off;n++) p[n]=r[n];
+    for(;n<len;n+=n)
+      memcpy(p+n,p,(len-n<n)?len-n:n);
+    return;
+  }
+  for(;len;len--) *p++=*r++;
+}
+
+/* what dblq_run does with the output, a constant at every call */
+#define DBLQ_STORE 0	/* write the decompressed data */
+#define DBLQ_COUNT 1	/* only walk the bitstream */
+
+/* called at each inner sync marker with the output position */
+typedef void (*dblq_mark_t)(void *ctx, int pos);
+
+/*
+ * fast: caller guarantees DBLQ_MAXREP+DBLQ_SLACK bytes of output room
+ * pos is the current output position, pout is only touched by DBLQ_STORE
+ */
+static inline __attribute__((always_inline))
+int dblq_decrep(bits64_t *pbits, int *pos, __u8 *pout, int lout,
+		 unsigned repoffs, int flg, int fast, int sink, ds_count_t *cnt,
+		 dblq_mark_t mark, void *ctx)
+{ int replen;
+
+  if(repoffs==0){LOG_DECOMP("DMSDOS: decrb: zero offset ?\n");return -2;}
+  if(repoffs==0x113f)
+  {
+    LOG_DECOMP("DMSDOS: decrb: 0x113f sync found.\n");
+    if((*pos%512) && !(flg&0x4000))
+    { LOG_DECOMP("DMSDOS: decrb: sync at decompressed pos %d ?\n",*pos);
+      return -2;
+    }
+    if(cnt) cnt->syncs++;
+    if(mark) mark(ctx,*pos);
+    return 0;
+  }
+  replen=dblq_rdlen(pbits)-1;
+
+  if(replen<=0)
+    {LOG_DECOMP("DMSDOS: decrb: illegal count ?\n");return -2;}
+  if(repoffs>(unsigned)*pos)
+    {LOG_DECOMP("DMSDOS: decrb: of>pos ?\n");return -2;}
+  if(!fast && *pos+replen>lout)
+    {LOG_DECOMP("DMSDOS: decrb: output overfill ?\n");return -2;}
+  if(sink==DBLQ_STORE)
+    dblq_copy(pout+*pos,repoffs,replen,fast||lout-*pos>=replen+DBLQ_SLACK);
+  if(cnt)
+  { cnt->reps++;
+    cnt->repbytes+=replen;
+  }
+  *pos+=replen;
+  return 0;
+}
+
+/* reads the DS header, then dblq_run() decodes the data */
+static inline __attribute__((always_inline))
+int dblq_start(ds_dec_t *s, void* pin, int lin, int lout, int flg)
+{ unsigned u;
+
+  dblq_rdi(&s->bits,pin,lin);
+  /* the last 16-bit word is left for the final sync */
+  s->lim=(((lin+1)>>1)-1)*16;
+  s->pos=0;
+  s->lout=lout;
+  s->flg=flg;
+  s->state=DS_ST_ERROR;
+  if((dblq_rdn(&s->bits,16))!=0x5344) return -1;
+
+  u=dblq_rdn(&s->bits,16);
+  u=((u&0xff)<<8)|((u>>8)&0xff);
+  LOG_DECOMP("DMSDOS: DS decompression version %d\n",u);
+  s->state=DS_ST_DATA;
+  return 0;
+}
+
+/*
+ * DS decompression core, inlined with a constant sink, cnt and mark
+ * decodes until the output position reaches stop, then returns it;
+ * at the end of the data the final sync is checked
+ * flg=0x4000 is used, when called from stacker_dec.c, because of
+ * stacker does not store original cluster size and it can mean,
+ * that last cluster in file can be ended by garbage
+ */
+static inline __attribute__((always_inline))
+int dblq_run(ds_dec_t *s, __u8* pout, int stop, int sink, ds_count_t *cnt,
+		 dblq_mark_t mark, void *ctx)
+{
+  unsigned u, v;
+  const dblb_tab_t *t;
+  int r, k, n, m, pos, lout=s->lout, lim=s->lim, flg=s->flg;
+  bits64_t bits;
+
+  if(s->state!=DS_ST_DATA) return s->state==DS_ST_END?s->pos:-2;
+  if(stop>lout) stop=lout;
+  bits=s->bits;
+  pos=s->pos;
+
+  /*
+   * fast loop: a token takes at most 4 input bytes and gives at most
+   * DBLQ_MAXREP output bytes, so n tokens need no bounds checks when
+   * both margins cover them; the input margin also keeps the reservoir
+   * away from the final sync word
+   */
+  r=0;
+  m=(stop<lout-DBLQ_SLACK)?stop:lout-DBLQ_SLACK;
+  while((n=(int)(bits.pe-bits.pd-16)>>2)>0)
+  { if(n>(m-pos)/DBLQ_MAXREP)
+      n=(m-pos)/DBLQ_MAXREP;
+    if(n<=0) break;
+    do
+    { if(bits.cnt<32)
+      { bits.buf|=dblq_ld64(bits.pd)<<bits.cnt;
+        bits.pd+=(63-bits.cnt)>>3;
+        bits.cnt|=56;
+      }
+      u=(unsigned)bits.buf;
+      /* up to three literals in 27 bits, the room for a match covers the stores */
+      if((k=dblb_lrun[DBLB_LRIX(u)])!=0)
+      { if(sink==DBLQ_STORE)
+        { pout[pos]=dblb_tok[u&511].base;
+          pout[pos+1]=dblb_tok[(u>>9)&511].base;
+          pout[pos+2]=dblb_tok[(u>>18)&511].base;
+        }
+        pos+=k;
+        DBLQ_SKIP(bits,9*k);
+        if(cnt) cnt->lits+=k;
+        continue;
+      }
+      t=&dblb_tok[u&511];
+      v=t->base+((u>>t->nb)&dblb_bmsk[t->xb]);
+      DBLQ_SKIP(bits,t->nb+t->xb);
+      if((r=dblq_decrep(&bits,&pos,pout,lout,v,flg,1,sink,cnt,mark,ctx))<0)
+        goto fail;
+    }while(--n);
+  }
+
+  /* careful tail loop */
+  while((pos<stop)&&(DBLQ_POS(bits)<lim))
+  {
+    /* a whole token is at most 15+17 bits */
+    if(bits.cnt<32) dblq_fill(&bits);
+    u=(unsigned)bits.buf;
+    t=&dblb_tok[u&511];
+    v=t->base+((u>>t->nb)&dblb_bmsk[t->xb]);
+    DBLQ_SKIP(bits,t->nb+t->xb);
+    if(t->kind==DBLB_LIT)
+    { if(sink==DBLQ_STORE) pout[pos]=v;
+      pos++;
+      if(cnt) cnt->lits++;
+    }
+    else if((r=dblq_decrep(&bits,&pos,pout,lout,v,flg,0,sink,cnt,mark,ctx))<0)
+      goto fail;
+  }
+
+  s->bits=bits;
+  s->pos=pos;
+  /* paused before the end of the data */
+  if((pos<lout)&&(DBLQ_POS(bits)<lim)) return pos;
+
+  if(!(flg&0x4000))
+  {
+    u=dblq_rdn(&s->bits,3);if(u==7) u=dblq_rdn(&s->bits,12)+320;
+    if(u!=0x113f)
+    { LOG_DECOMP("DMSDOS: decrb: final sync not found?\n");
+      r=-2;
+      goto fail;
+    }
+  }
+
+  s->state=DS_ST_END;
+  return pos;
+
+fail:
+  s->state=DS_ST_ERROR;
+  return r;
+}
+
+#endif /* bmfdec_core_h */
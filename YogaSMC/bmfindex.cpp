@@ -0,0 +1,486 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfindex.cpp
+//  YogaSMC
+//
+//  Flat index of a decompressed MOF buffer, see MOFIndex.
+//
+
+#include "bmfindex.hpp"
+#include "bmfutf.h"
+
+#define error(str) do { IOLog("%d: error %s at %s:%d\n", indent, str, __func__, __LINE__); return false;} while (0)
+
+MOFIndex::~MOFIndex() {
+    if (nodes)
+        IOFree(nodes, capacity * sizeof(mof_node));
+}
+
+uint32_t MOFIndex::read32(uint32_t offset) {
+    uint32_t v;
+    memcpy(&v, buf + offset, sizeof(v));
+    return v;
+}
+
+// Appends n blank nodes, the node array may move
+bool MOFIndex::reserve(uint32_t n, uint32_t *first) {
+    if (count + n > capacity) {
+        uint32_t cap = capacity ? capacity : 64;
+        while (cap < count + n)
+            cap *= 2;
+        mof_node *p = (mof_node *)IOMalloc(cap * sizeof(mof_node));
+        if (!p) error("allocation failed");
+        if (nodes) {
+            memcpy(p, nodes, count * sizeof(mof_node));
+            IOFree(nodes, capacity * sizeof(mof_node));
+        }
+        nodes = p;
+        capacity = cap;
+    }
+    memset(nodes + count, 0, n * sizeof(mof_node));
+    *first = count;
+    count += n;
+    return true;
+}
+
+// Skips n records starting at offset, each led by its length
+bool MOFIndex::scan(uint32_t offset, uint32_t limit, uint32_t n, uint32_t *end) {
+    uint32_t len;
+
+    for (uint32_t i=0; i<n; i++) {
+        if (limit - offset < 0x14) error("record exceeded");
+        len = read32(offset);
+        if (len < 0x14 || len > limit - offset) error("record length exceeded");
+        offset += len;
+    }
+    *end = offset;
+    return true;
+}
+
+/*
+ * n elements of a ValueMap array, walked as getElement does: strings and
+ * datetimes end at a NUL or after 0x99 units, integers take their size
+ * and other types take none.
+ */
+bool MOFIndex::scanArray(uint32_t offset, uint32_t end, uint8_t type, uint32_t n) {
+    uint32_t len;
+
+    for (uint32_t i=0; i<n; i++) {
+        if (offset > end) error("valuemap exceeded");
+        switch (type) {
+            case MOF_STRING:
+            case MOF_DATETIME:
+                for (len=0; len<0x99; len++) {
+                    if (end - offset < 2 * len + 2) error("valuemap exceeded");
+                    if ((buf[offset + 2*len] | buf[offset + 2*len + 1]) == 0)
+                        break;
+                }
+                offset += 2 * len + 2;
+                break;
+
+            default:
+                len = mof_int_size(type);
+                if (end - offset < len) error("valuemap exceeded");
+                offset += len;
+                break;
+        }
+    }
+    return true;
+}
+
+// Scalar of len bytes at offset, an integer shorter than its type stays a span
+void MOFIndex::decode(mof_value *value, uint32_t offset, uint32_t len) {
+    uint32_t n = mof_int_size(value->type);
+    uint64_t v = 0;
+
+    value->size = len;
+    value->span.offset = offset;
+    value->span.len = len;
+    if (value->type == MOF_BOOLEAN) {
+        if (len == 4)
+            value->uint = read32(offset);
+        else if (len == 2)
+            value->uint = read16(offset);
+        return;
+    }
+    if (!n || len < n)
+        return;
+    memcpy(&v, buf + offset, n);
+    if (mof_int_signed(value->type) && n < 8)
+        v = (uint64_t)((int64_t)(v << (64 - 8*n)) >> (64 - 8*n));
+    value->uint = v;
+}
+
+uint32_t MOFIndex::getElement(const mof_node *node, uint32_t offset, mof_value *value) {
+    uint32_t len;
+
+    memset(value, 0, sizeof(mof_value));
+    value->type = node->type;
+    switch (node->type) {
+        case MOF_STRING:
+        case MOF_DATETIME:
+            for (len=0; len<0x99 && read16(offset + 2*len); len++);
+            value->span.offset = offset;
+            value->span.len = value->size = 2 * len;
+            return 2 * len + 2;
+
+        default:
+            len = mof_int_size(node->type);
+            decode(value, offset, len);
+            return len;
+    }
+}
+
+// Block of length, count and count records
+bool MOFIndex::scanBlock(uint32_t offset, uint32_t limit, uint32_t *n, uint32_t *end) {
+    if (limit - offset < 8) error("block exceeded");
+    *n = read32(offset + 4);
+    if (*n > 0xff) error("count exceeded");
+    return scan(offset + 8, limit, *n, end);
+}
+
+// Queues node i, indexClass or indexItem fill it in once indexPending reaches it
+bool MOFIndex::pend(uint32_t i, uint32_t offset, uint32_t limit, uint8_t kind, uint8_t role, uint32_t depth) {
+    if (depth > MOF_MAX_DEPTH) error("nesting too deep");
+    nodes[i].offset = offset;
+    nodes[i].length = limit;
+    nodes[i].kind = kind;
+    nodes[i].role = role;
+    nodes[i].child = depth;
+    return true;
+}
+
+/*
+ * Children are always appended after their parent, so walking forward from
+ * first visits every pending node exactly once, without recursion.
+ */
+bool MOFIndex::indexPending(uint32_t first) {
+    for (uint32_t i=first; i<count; i++) {
+        if (nodes[i].kind == MOF_NODE_CLASS) {
+            if (!indexClass(i)) return false;
+        } else if (!indexItem(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Same layout as MOF::parse_class, a class has qualifiers, variables and
+ * methods, a parameter class only variables and methods.
+ */
+bool MOFIndex::indexClass(uint32_t i) {
+    static const uint8_t roles[3] = {MOF_ROLE_QUALIFIER, MOF_ROLE_VARIABLE, MOF_ROLE_METHOD};
+    uint32_t start[3], n[3], total = 0, first, p, end;
+    uint32_t b, k, len, type, offset, limit, depth;
+
+    offset = nodes[i].offset;
+    limit = nodes[i].length;
+    depth = indent = nodes[i].child;
+    if (limit - offset < 0x14) error("class exceeded");
+    len = read32(offset);
+    type = read32(offset + 4);
+    if (len < 0x14 || len > limit - offset) error("class length exceeded");
+    if (type != 0 && type != 0xFFFFFFFF) error("Wrong class type");
+    if (type && read32(offset + 8) != 0) error("Wrong class pattern");
+    k = read32(offset + 16);
+    if (k != 0 && k != 1) error("Wrong class type");
+
+    end = offset + len;
+    p = offset + 0x14;
+    for (b = type ? 1 : 0; b < 3; b++) {
+        start[b] = p;
+        if (!scanBlock(p, end, &n[b], &p)) return false;
+        total += n[b];
+    }
+    if (!reserve(total, &first)) return false;
+
+    nodes[i].length = len;
+    nodes[i].type = type ? 1 : 0;
+    nodes[i].child = first;
+    nodes[i].count = total;
+
+    for (b = type ? 1 : 0; b < 3; b++) {
+        p = start[b] + 8;
+        for (k=0; k<n[b]; k++) {
+            if (!pend(first++, p, end, MOF_NODE_VALUE, roles[b], depth + 1)) return false;
+            p += read32(p);
+        }
+    }
+    return true;
+}
+
+// Same layout as MOF::parse_method
+bool MOFIndex::indexItem(uint32_t i) {
+    uint32_t len, end, nlen, clen, p, n, m, first, k, offset, limit, depth;
+    uint8_t type, map;
+
+    offset = nodes[i].offset;
+    limit = nodes[i].length;
+    depth = indent = nodes[i].child;
+    nodes[i].child = 0;
+    if (limit - offset < 0x14) error("item exceeded");
+    len = read32(offset);
+    if (len < 0x14 || len > limit - offset) error("item length exceeded");
+    end = offset + len;
+
+    type = buf[offset + 4];
+    map = buf[offset + 5];
+    switch (type) {
+        case MOF_BOOLEAN:
+        case MOF_STRING:
+        case MOF_OBJECT:
+        case MOF_DATETIME:
+        case MOF_SINT8:
+        case MOF_UINT8:
+        case MOF_SINT16:
+        case MOF_UINT16:
+        case MOF_SINT32:
+        case MOF_UINT32:
+        case MOF_SINT64:
+        case MOF_UINT64:
+            break;
+
+        default:
+            error("unknown type");
+    }
+    if (map != 0 && map != MOF_NODE_ARRAY) error("unknown map type");
+    if (read32(offset + 8) != 0) error("wrong method pattern");
+
+    nlen = read32(offset + 12);
+    clen = read32(offset + 16);
+    p = offset + (clen != 0xFFFFFFFF && clen > 0xFFFF ? 0x10 : 0x14);
+
+    nodes[i].length = len;
+    nodes[i].type = type;
+    nodes[i].flags = map;
+
+    if (type != MOF_OBJECT || map != MOF_NODE_ARRAY) {
+        if (nlen == 0xFFFFFFFF) {
+            // Name and qualifiers only
+            if (clen > 0xFFFF || clen > end - p) error("name length exceeded");
+            nodes[i].kind = MOF_NODE_OBJECT;
+            nodes[i].name = p;
+            nodes[i].nlen = clen;
+            p += clen;
+            if (!scanBlock(p, end, &n, &m)) return false;
+            if (!reserve(n, &first)) return false;
+            nodes[i].child = first;
+            nodes[i].count = n;
+            for (p += 8, k=0; k<n; k++) {
+                if (!pend(first++, p, end, MOF_NODE_VALUE, MOF_ROLE_QUALIFIER, depth + 1)) return false;
+                p += read32(p);
+            }
+        } else {
+            if (nlen > 0xFFFF || nlen > end - p) error("name length exceeded");
+            nodes[i].kind = MOF_NODE_VALUE;
+            nodes[i].name = p;
+            nodes[i].nlen = nlen;
+            p += nlen;
+
+            if (clen == 0xFFFFFFFF)
+                clen = len-0x14-nlen;
+            else if (clen > 0xFFFF)
+                clen = len-0x10-nlen;
+            else {
+                if (clen != len-0x1c) error("content length calc error");
+                if (clen < nlen) error("content length calc error");
+                clen -= nlen;
+            }
+            if (clen > end - p) error("value length exceeded");
+            nodes[i].value.type = type;
+            nodes[i].value.flags = map;
+
+            // ValueMap
+            if (map == MOF_NODE_ARRAY) {
+                if (clen < 0x10) error("valuemap length mismatch");
+                if (read32(p) != clen) error("valuemap length mismatch");
+                if (read32(p + 4) != 1) error("valuemap pattern mismatch");
+                if (read32(p + 12) != clen-0xc) error("valuemap content length mismatch");
+                n = read32(p + 8);
+                if (n > 0xff) error("count exceeded");
+                if (!scanArray(p + 0x10, p + clen, type, n)) return false;
+                nodes[i].value.span.offset = p + 0x10;
+                nodes[i].value.span.len = clen - 0x10;
+                nodes[i].value.size = n;
+            } else {
+                decode(&nodes[i].value, p, clen);
+            }
+        }
+    } else {
+        // Method, parameter classes then qualifiers
+        if (nlen > 0xFFFF || nlen > end - offset - 0x14 || nlen > end - p) error("name length exceeded");
+        nodes[i].kind = MOF_NODE_METHOD;
+        nodes[i].name = offset + 0x14;
+        nodes[i].nlen = nlen;
+        p += nlen;
+        if (end - p < 0x10) error("method exceeded");
+        if (read32(p + 4) != 1) error("pattern mismatch");
+        n = read32(p + 8);
+        if (n > 0xff) error("count exceeded");
+        p += 0x10;
+        if (!scan(p, end, n, &m)) return false;
+        if (!scanBlock(m, end, &k, &m)) return false;
+        if (!reserve(n + k, &first)) return false;
+        nodes[i].child = first;
+        nodes[i].count = n + k;
+        for (m=0; m<n; m++) {
+            if (!pend(first++, p, end, MOF_NODE_CLASS, MOF_ROLE_PARAMETER, depth + 1)) return false;
+            p += read32(p);
+        }
+        for (p += 8, m=0; m<k; m++) {
+            if (!pend(first++, p, end, MOF_NODE_VALUE, MOF_ROLE_QUALIFIER, depth + 1)) return false;
+            p += read32(p);
+        }
+    }
+    return true;
+}
+
+bool MOFIndex::begin() {
+    uint32_t first;
+
+    count = classes = flavors = done = 0;
+    indent = 0;
+    if (size < 0x14) error("header exceeded");
+    if (read32(0) != 0x424D4F46) error("header mismatch");
+    if (read32(8) != 1 || read32(12) != 1) error("pattern mismatch");
+    classes = read32(16);
+    if (classes > 0xff) error("count exceeded");
+    if (!reserve(1 + classes, &first)) return false;
+
+    nodes[0].kind = MOF_NODE_ROOT;
+    nodes[0].length = size;
+    nodes[0].child = 1;
+    nodes[0].count = classes;
+    next = 0x14;
+    return true;
+}
+
+uint32_t MOFIndex::nextLength() {
+    if (done >= classes || size - next < 4)
+        return 0;
+    return read32(next);
+}
+
+bool MOFIndex::addClass() {
+    uint32_t first = count;
+
+    if (done >= classes) error("count exceeded");
+    if (!pend(1 + done, next, size, MOF_NODE_CLASS, MOF_ROLE_CLASS, 1)) return false;
+    if (!indexClass(1 + done) || !indexPending(first)) return false;
+    next += nodes[1 + done].length;
+    done++;
+    return true;
+}
+
+/*
+ * Open addressing table from record offset to item node, filled once
+ * the classes are indexed. Node 0 is the root, so 0 marks a free slot.
+ */
+bool MOFIndex::mapOffsets(uint32_t **map, uint32_t *mask) {
+    uint32_t size = 16, h;
+
+    while (size < 2 * count)
+        size *= 2;
+    *map = (uint32_t *)IOMalloc(size * sizeof(uint32_t));
+    if (!*map) error("allocation failed");
+    memset(*map, 0, size * sizeof(uint32_t));
+    *mask = size - 1;
+
+    for (uint32_t i=1; i<count; i++) {
+        if (nodes[i].kind == MOF_NODE_CLASS || nodes[i].kind == MOF_NODE_FLAVOR)
+            continue;
+        h = (nodes[i].offset * 2654435761U) & *mask;
+        while ((*map)[h] && nodes[(*map)[h]].offset != nodes[i].offset)
+            h = (h + 1) & *mask;
+        if (!(*map)[h])
+            (*map)[h] = i;
+    }
+    return true;
+}
+
+/*
+ * Footer: 'BMOFQUALFLAVOR11', count, then address and type of each
+ * qualifier with a flavor. A flavor points at the item already indexed
+ * at its address, only an address outside the classes is indexed again.
+ */
+bool MOFIndex::end() {
+    uint32_t n, first, item, p, addr, type, h, mask, *map;
+
+    if (done != classes) error("classes missing");
+    if (size - next < 0x14) error("footer exceeded");
+    if (read32(next) != 0x464F4D42 || read32(next + 4) != 0x4C415551 ||
+        read32(next + 8) != 0x56414C46 || read32(next + 12) != 0x3131524F)
+        error("footer mismatch");
+    n = read32(next + 16);
+    if (n > 0x1ff) error("count exceeded");
+    if ((size - next - 0x14) / 8 < n) error("offsets exceeded");
+    if (!reserve(n, &first)) return false;
+    if (!mapOffsets(&map, &mask)) return false;
+
+    flavor = first;
+    for (uint32_t i=0; i<n; i++) {
+        p = next + 0x14 + i * 8;
+        addr = read32(p);
+        type = read32(p + 4);
+        nodes[first + i].kind = MOF_NODE_FLAVOR;
+        nodes[first + i].role = MOF_ROLE_FLAVOR;
+        nodes[first + i].offset = addr;
+        nodes[first + i].type = type > 0xff ? 0xff : type;
+        nodes[first + i].count = 1;
+        h = (addr * 2654435761U) & mask;
+        while (map[h] && nodes[map[h]].offset != addr)
+            h = (h + 1) & mask;
+        if (map[h]) {
+            nodes[first + i].child = map[h];
+            continue;
+        }
+        if (addr > size || !reserve(1, &item) ||
+            !pend(item, addr, size, MOF_NODE_VALUE, MOF_ROLE_FLAVOR, 1)) {
+            IOFree(map, (mask + 1) * sizeof(uint32_t));
+            if (addr > size) error("offset exceeded");
+            return false;
+        }
+        nodes[first + i].child = item;
+    }
+    IOFree(map, (mask + 1) * sizeof(uint32_t));
+    if (!indexPending(first + n)) return false;
+    flavors = n;
+    return true;
+}
+
+bool MOFIndex::build() {
+    if (!begin()) return false;
+    while (done < classes)
+        if (!addClass()) return false;
+    return end();
+}
+
+uint32_t MOFIndex::getString(uint32_t offset, uint32_t len, char *out, uint32_t size) {
+    mof_utf16_to_utf8(buf + offset, len / 2, out, size);
+    return mof_utf8_len(buf + offset, len / 2);
+}
+
+// Exact match against an ASCII string, the UTF-16 span may be NUL terminated
+bool MOFIndex::stringEquals(uint32_t offset, uint32_t len, const char *name) {
+    uint32_t i, n = len / 2;
+    uint16_t u;
+
+    for (i=0; i<n; i++) {
+        u = buf[offset + 2*i] | buf[offset + 2*i + 1] << 8;
+        if (u == 0)
+            break;
+        if (u != (uint8_t)name[i])
+            return false;
+    }
+    return name[i] == 0;
+}
+
+const mof_node *MOFIndex::findChild(const mof_node *node, const char *name, uint8_t role) {
+    const mof_node *child;
+
+    for (uint32_t i=0; (child = getChild(node, i)); i++)
+        if (child->role == role && nameEquals(child, name))
+            return child;
+    return nullptr;
+}
@@ -0,0 +1,195 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfindex.hpp
+//  YogaSMC
+//
+//  Flat index of a decompressed MOF buffer, see MOFIndex.
+//
+
+#ifndef bmfindex_hpp
+#define bmfindex_hpp
+
+#include <IOKit/IOLib.h>
+
+enum mof_offset_type {
+  MOF_OFFSET_UNKNOWN,
+  MOF_OFFSET_BOOLEAN = 0x01,
+  MOF_OFFSET_OBJECT = 0x02,
+  MOF_OFFSET_STRING = 0x03,
+  MOF_OFFSET_SINT32 = 0x11,
+};
+
+
+enum mof_data_type {
+  MOF_UNKNOWN,
+  MOF_SINT16 = 0x02,
+  MOF_SINT32 = 0x03,
+  MOF_STRING = 0x08,
+  MOF_BOOLEAN = 0x0B,
+  MOF_OBJECT = 0x0D,
+  MOF_SINT8 = 0x10,
+  MOF_UINT8 = 0x11,
+  MOF_UINT16 = 0x12,
+  MOF_UINT32 = 0x13,
+  MOF_SINT64 = 0x14,
+  MOF_UINT64 = 0x15,
+  MOF_DATETIME = 0x65,
+};
+
+// Bytes of an integer type, 0 for the others
+static inline uint32_t mof_int_size(uint8_t type) {
+    switch (type) {
+        case MOF_SINT8:
+        case MOF_UINT8:
+            return 1;
+        case MOF_SINT16:
+        case MOF_UINT16:
+            return 2;
+        case MOF_SINT32:
+        case MOF_UINT32:
+            return 4;
+        case MOF_SINT64:
+        case MOF_UINT64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static inline bool mof_int_signed(uint8_t type) {
+    return type == MOF_SINT8 || type == MOF_SINT16 || type == MOF_SINT32 || type == MOF_SINT64;
+}
+
+enum mof_node_kind {
+    MOF_NODE_ROOT,
+    MOF_NODE_CLASS,     // class, or parameters of a method
+    MOF_NODE_VALUE,     // named scalar or array value
+    MOF_NODE_OBJECT,    // named item with qualifiers only
+    MOF_NODE_METHOD,    // parameter classes and qualifiers
+    MOF_NODE_FLAVOR,    // BMOFQUALFLAVOR11 entry, child is the item
+};
+
+// Block a node belongs to in its parent
+enum mof_node_role {
+    MOF_ROLE_NONE,
+    MOF_ROLE_CLASS,
+    MOF_ROLE_QUALIFIER,
+    MOF_ROLE_VARIABLE,
+    MOF_ROLE_METHOD,
+    MOF_ROLE_PARAMETER,
+    MOF_ROLE_FLAVOR,
+};
+
+#define MOF_NODE_ARRAY 0x20 // same as the map byte of the item
+#define MOF_MAX_DEPTH 16    // class, method, parameter class, object, qualifier nest 5 deep
+
+/*
+ * 16 bytes, tagged by type. Integers and booleans are decoded, signed
+ * ones sign extended. Strings, datetimes, arrays and other types stay a
+ * span of the buffer, UTF-16LE for strings.
+ */
+struct mof_value {
+    union {
+        int64_t sint;
+        uint64_t uint;
+        struct {
+            uint32_t offset;
+            uint32_t len;
+        } span;
+    };
+    uint32_t size;      // bytes of a scalar, elements of an array
+    uint8_t type;       // mof_data_type
+    uint8_t flags;      // MOF_NODE_ARRAY
+    uint16_t reserved;
+};
+
+/*
+ * 40 bytes per class, item or qualifier. All offsets are into the
+ * decompressed buffer, names and string values stay UTF-16LE there.
+ */
+struct mof_node {
+    uint32_t offset;    // start of the record
+    uint32_t length;    // record length
+    uint32_t name;      // name offset
+    uint32_t child;     // first child node
+    uint16_t nlen;      // name bytes
+    uint16_t count;     // child nodes
+    uint8_t kind;       // mof_node_kind
+    uint8_t role;       // mof_node_role
+    uint8_t type;       // mof_data_type, 1 for parameter classes, offset type for flavors
+    uint8_t flags;      // MOF_NODE_ARRAY
+    mof_value value;    // MOF_NODE_VALUE only
+};
+
+/*
+ * Children of a node are contiguous, [child, child+count), and keep the
+ * order of the buffer: qualifiers, variables and methods for classes,
+ * parameter classes and qualifiers for methods, classes for the root
+ * (node 0). Flavors are listed separately, their child is the qualifier
+ * node at the flavor address, not a copy of it. Nodes are indexed breadth
+ * first from a work list, no deeper than MOF_MAX_DEPTH.
+ *
+ * Indexing is the validation pass: every record, name and value span,
+ * ValueMap elements included, is within the buffer once it succeeds, so
+ * readers of the nodes skip bounds checks.
+ */
+class MOFIndex {
+
+public:
+    MOFIndex(const char *data, uint32_t size) {buf = (const uint8_t *)data; this->size = size;};
+    ~MOFIndex();
+
+    // Header, then classes one by one, then the footer; build() does all
+    bool begin();
+    bool addClass();
+    bool end();
+    bool build();
+
+    // Offset and length of the next class for addClass, 0 when done
+    uint32_t nextOffset() {return next;};
+    uint32_t nextLength();
+
+    uint32_t getCount() {return count;};
+    uint32_t getClasses() {return classes;};
+    uint32_t getFlavors() {return flavors;};
+    const mof_node *getFlavor(uint32_t i) {return i < flavors ? &nodes[flavor + i] : nullptr;};
+    const mof_node *getNode(uint32_t i) {return i < count ? &nodes[i] : nullptr;};
+    const mof_node *getChild(const mof_node *node, uint32_t i) {return node->kind != MOF_NODE_VALUE && i < node->count ? &nodes[node->child + i] : nullptr;};
+    const mof_node *findChild(const mof_node *node, const char *name, uint8_t role);
+    size_t getMemory() {return capacity * sizeof(mof_node);};
+
+    // UTF-8 copy of a UTF-16LE span into out, see mof_utf16_to_utf8, returns the full length
+    uint32_t getString(uint32_t offset, uint32_t len, char *out, uint32_t size);
+    bool stringEquals(uint32_t offset, uint32_t len, const char *name);
+    bool nameEquals(const mof_node *node, const char *name) {return stringEquals(node->name, node->nlen, name);};
+    uint32_t read32(uint32_t offset);
+    // Element of an array at offset, returns its bytes, see scanArray
+    uint32_t getElement(const mof_node *node, uint32_t offset, mof_value *value);
+    uint16_t read16(uint32_t offset) {return buf[offset] | buf[offset + 1] << 8;};
+
+private:
+    bool reserve(uint32_t n, uint32_t *first);
+    bool pend(uint32_t i, uint32_t offset, uint32_t limit, uint8_t kind, uint8_t role, uint32_t depth);
+    bool indexPending(uint32_t first);
+    bool indexClass(uint32_t i);
+    bool indexItem(uint32_t i);
+    bool scan(uint32_t offset, uint32_t limit, uint32_t n, uint32_t *end);
+    bool scanBlock(uint32_t offset, uint32_t limit, uint32_t *n, uint32_t *end);
+    bool scanArray(uint32_t offset, uint32_t end, uint8_t type, uint32_t n);
+    void decode(mof_value *value, uint32_t offset, uint32_t len);
+    bool mapOffsets(uint32_t **map, uint32_t *mask);
+
+    const uint8_t *buf;
+    uint32_t size;
+    mof_node *nodes {nullptr};
+    uint32_t count {0};
+    uint32_t capacity {0};
+    uint32_t classes {0};
+    uint32_t flavors {0};
+    uint32_t flavor {0};
+    uint32_t next {0};
+    uint32_t done {0};
+    int indent {0};
+};
+
+#endif /* bmfindex_hpp */
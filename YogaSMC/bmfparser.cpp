@@ -15,70 +15,116 @@
 #define errors(str) do { IOLog("%d: error %s at %s:%d\n", indent, str, __func__, __LINE__); parsed = false;} while (0)
 #define warning(str) do { IOLog("%d: warning %s at %s:%d\n", indent, str, __func__, __LINE__);} while (0)
 
+MOF::~MOF() {
+    OSSafeReleaseNULL(valuemap);
+    OSSafeReleaseNULL(vmap);
+    for (uint32_t i=0; i<nclasses; i++)
+        OSSafeReleaseNULL(classes[i].dict);
+    if (classes)
+        IOFree(classes, nclasses * sizeof(mof_class));
+}
+
+// Lower case form of a 36 character GUID, or 38 with braces
+static bool mof_guid(const char *str, uint32_t len, char *out) {
+    char guid_string[37];
+    uuid_t guid_t;
+
+    if (len == 38) {
+        strncpy(guid_string, str + 1, 36);
+        guid_string[36] = 0;
+        str = guid_string;
+    } else if (len != 36) {
+        return false;
+    }
+    if (uuid_parse(str, guid_t))
+        return false;
+    uuid_unparse_lower(guid_t, out);
+    return true;
+}
+
 char *MOF::parse_string(char *buf, uint32_t size) {
-  uint16_t *buf2 = (uint16_t *)buf;
   if (size % 2 != 0) errors("Invalid size");
-//  char *out = (char *)malloc(size+1);
-//  if (!out) error("malloc failed");
-  char *out = new char[size+1];
-  uint32_t i, j;
-  for (i=0, j=0; i<size/2; ++i) {
-    if (buf2[i] == 0) {
-      break;
-    } else if (buf2[i] < 0x80) {
-      out[j++] = buf2[i];
-    } else if (buf2[i] < 0x800) {
-      out[j++] = 0xC0 | (buf2[i] >> 6);
-      out[j++] = 0x80 | (buf2[i] & 0x3F);
-    } else if (buf2[i] >= 0xD800 && buf2[i] <= 0xDBFF && i+1 < size/2 && buf2[i+1] >= 0xDC00 && buf2[i+1] <= 0xDFFF) {
-      uint32_t c = 0x10000 + ((buf2[i] - 0xD800) << 10) + (buf2[i+1] - 0xDC00);
-      ++i;
-      out[j++] = 0xF0 | (c >> 18);
-      out[j++] = 0x80 | ((c >> 12) & 0x3F);
-      out[j++] = 0x80 | ((c >> 6) & 0x3F);
-      out[j++] = 0x80 | (c & 0x3F);
-    } else if (buf2[i] >= 0xD800 && buf2[i] <= 0xDBFF && i+1 < size/2 && buf2[i+1] >= 0xDC00 && buf2[i+1] <= 0xDFFF) {
-      uint32_t c = 0x10000 + ((buf2[i] - 0xD800) << 10) + (buf2[i+1] - 0xDC00);
-      ++i;
-      out[j++] = 0xF0 | (c >> 18);
-      out[j++] = 0x80 | ((c >> 12) & 0x3F);
-      out[j++] = 0x80 | ((c >> 6) & 0x3F);
-      out[j++] = 0x80 | (c & 0x3F);
-    } else {
-      out[j++] = 0xE0 | (buf2[i] >> 12);
-      out[j++] = 0x80 | ((buf2[i] >> 6) & 0x3F);
-      out[j++] = 0x80 | (buf2[i] & 0x3F);
-    }
+  // scratch, valid until the arena scope of the caller ends
+  uint32_t len = mof_utf8_len(buf, size/2);
+  char *out = (char *)arena.alloc(len+1);
+  if (!out) {
+    errors("allocation failed");
+    return (char *)"";
   }
-  out[j] = 0;
+  mof_utf16_to_utf8(buf, size/2, out, len+1);
   return out;
 }
 
-uint16_t MOF::parse_valuemap(uint16_t *buf, bool map, uint32_t i) {
+// Element i of the array being parsed
+void MOF::parse_valuemap(mof_frame *f, uint32_t i, const mof_value *element) {
+    MOFArena::Scope scope(&arena);
     OSString *value;
-    uint32_t len = 0;
-    while (buf[len] != 0 && len < 0x99)
-        len++;
-    value = OSString::withCString(parse_string((char *)buf, len*2));
-    if (map)
+    char res[12];
+
+    switch (element->type) {
+        case MOF_STRING:
+            value = OSString::withCString(parse_string(buf + element->span.offset, element->span.len));
+            break;
+
+        case MOF_SINT32:
+            snprintf(res, sizeof(res), "%d", (int32_t)element->sint);
+            value = OSString::withCString(res);
+            break;
+
+        default:
+            return;
+    }
+    if (f->map)
       valuemap->setObject(i, value);
     else
       vmap->setObject(value, valuemap->getObject(i));
     OSSafeReleaseNULL(value);
-    return len+1;
 }
 
-uint32_t MOF::parse_valuemap(int32_t *buf, bool map, uint32_t i) {
-    OSString *value;
-    char * res = new char[10];
-    snprintf(res, 10, "%d", buf[0]);
-    value = OSString::withCString(res);
-    if (map)
-      valuemap->setObject(i, value);
-    else
-      vmap->setObject(value, valuemap->getObject(i));
-    OSSafeReleaseNULL(value);
-    return 1;
+/*
+ * Values stay a mof_value in the index until published, this is the only
+ * place a scalar becomes a libkern object. Integers keep the width of
+ * their type, signed ones included: a SINT32 is a 32-bit OSNumber whose
+ * unsigned32BitValue() cast to int32_t gives the value back. nullptr
+ * after an error.
+ */
+OSObject* MOF::parse_value(const mof_value *value) {
+    uint32_t n = mof_int_size(value->type);
+
+    switch (value->type) {
+        case MOF_BOOLEAN:
+            if (value->size != 4 && value->size != 2) {
+                errors("boolean length mismatch");
+                return nullptr;
+            }
+            switch (value->uint) {
+                case 0:
+                    return kOSBooleanFalse;
+
+                case 0xFFFF:
+                    return kOSBooleanTrue;
+
+                default:
+                    errors("invalid boolean");
+                    return nullptr;
+            }
+
+        case MOF_STRING:
+        case MOF_DATETIME:
+            return OSString::withCString(parse_string(buf + value->span.offset, value->span.len));
+
+        case MOF_OBJECT:
+            break;
+
+        default:
+            if (value->size != n) {
+                errors("integer length mismatch");
+                return nullptr;
+            }
+            return OSNumber::withNumber(value->uint, n * 8);
+    }
+    errors("unexpected value type");
+    return OSData::withBytes(buf + value->span.offset, value->span.len);
 }
 
 /*
@@ -97,14 +143,15 @@ uint32_t MOF::parse_valuemap(int32_t *buf, bool map, uint32_t i) {
  *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  */
 
-OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
-    indent +=1;
-    OSDictionary *dict = OSDictionary::withCapacity(5);
-    uint8_t *type = (uint8_t *)buf + 4;
+OSDictionary* MOF::parse_method(mof_frame *f, uint32_t verify) {
+    MOFArena::Scope scope(&arena);
+    const mof_node *node = f->node;
+    OSDictionary *dict = f->dict = OSDictionary::withCapacity(5);
+    uint8_t type[2] = {node->type, node->flags};
     OSObject *typeObj;
-    OSDictionary *item;
+    const mof_node *child;
 #ifdef DEBUG
-    typeObj = OSNumber::withNumber(buf[0], 32);
+    typeObj = OSNumber::withNumber(node->length, 32);
     dict->setObject("length", typeObj);
     typeObj->release();
 #endif
@@ -132,40 +179,14 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
             break;
     }
 
-    switch (type[0]) {
-        case MOF_BOOLEAN:
-            typeObj = OSString::withCString("BOOLEAN");
-            break;
-
-        case MOF_STRING:
-            typeObj = OSString::withCString("STRING");
-            break;
-
-        case MOF_SINT32:
-            typeObj = OSString::withCString("SINT32");
-            break;
-
-        case MOF_OBJECT:
-            typeObj = OSString::withCString("OBJECT");
-            break;
-
-        case MOF_UINT8:
-            typeObj = OSString::withCString("UINT8");
-            break;
-
-        case MOF_UINT32:
-            typeObj = OSString::withCString("UINT32");
-            break;
-
-        default:
-            typeObj = OSNumber::withNumber(type[0], 8);
-            dict->setObject("type", typeObj);
-            OSSafeReleaseNULL(typeObj);
-            error("unknown type");
-            break;
+    const OSSymbol *label = type[0] != MOF_UNKNOWN ? symbols.getLabel(type[0]) : nullptr;
+    if (!label) {
+        typeObj = OSNumber::withNumber(type[0], 8);
+        dict->setObject("type", typeObj);
+        OSSafeReleaseNULL(typeObj);
+        error("unknown type");
     }
-    dict->setObject("type", typeObj);
-    typeObj->release();
+    dict->setObject("type", label);
 
     switch (type[1]) {
         case 0:
@@ -184,41 +205,29 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
             break;
     }
 
-    if (buf[2] != 0) error("wrong method pattern");
-    uint32_t nlen = buf[3];
-    uint32_t clen = buf[4];
-    uint32_t *nbuf = buf + (buf[4] != 0xFFFFFFFF && buf[4] > 0xFFFF ? 4:5);
-    
+    // Interned, no decoding for names seen before
+    const mof_symbol *sym = symbols.intern(node->name, node->nlen);
+    if (!sym) error("allocation failed");
+    const OSSymbol *name = sym->name;
+    uint8_t known = sym->known;
+
     // Variables or Qualifiers
     if (type[0] != MOF_OBJECT | type[1] != 0x20) {
-        char *name;
         // Variable map or objects
-        if (nlen == 0xFFFFFFFF) {
-            name = parse_string((char *)nbuf, clen);
-            nbuf = (uint32_t *)((char *)nbuf + clen);
-            uint32_t count = nbuf[1];
-            if (count > 0xff) error("count exceeded");
-            OSDictionary *variables = OSDictionary::withCapacity(count+3);
-            nbuf += 2;
-            for (uint32_t i=0; i<count; i++) {
-                item = parse_method(nbuf);
-                variables->merge(item);
-                item->release();
-                nbuf = (uint32_t *)((char *)nbuf + nbuf[0]);
-            }
-            dict->flushCollection();
-            dict->setObject(name, variables);
-            variables->release();
+        if (node->kind == MOF_NODE_OBJECT) {
+            // qualifiers are collected by the walk, see endBlock
+            f->name = name;
+            f->block = OSDictionary::withCapacity(node->count+3);
+            f->stage = MOF_STAGE_OBJECT;
         }
         else
         {
-            name = parse_string((char *)nbuf, nlen);
             switch (verify) {
                 case 0:
                     break;
 
                 case MOF_OFFSET_BOOLEAN:
-                    if (strcasecmp(name, "Dynamic") == 0)
+                    if (known == MOF_NAME_DYNAMIC)
                     {
                         dict->flushCollection();
                         break;
@@ -229,7 +238,7 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
                     break;
 
                 case MOF_OFFSET_STRING:
-                    if (strcmp(name, "CIMTYPE") == 0)
+                    if (known == MOF_NAME_CIMTYPE)
                     {
                         dict->flushCollection();
                         // TODO: verify "object:" of upper item
@@ -237,7 +246,7 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
                     }
 
                 case MOF_OFFSET_SINT32:
-                    if (strcmp(name, "ID") == 0)
+                    if (known == MOF_NAME_ID)
                     {
                         dict->flushCollection();
                         break;
@@ -248,106 +257,41 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
                     break;
             }
 
-            nbuf = (uint32_t *)((char *)nbuf + nlen);
-
-            if (clen == 0xFFFFFFFF)
-                clen = buf[0]-0x14-nlen;
-            else if (clen > 0xFFFF)
-                clen = buf[0]-0x10-nlen;
-            else {
-                if (clen != buf[0]-0x1c) error("content length calc error");
-                clen -= nlen;
-            }
-
             // ValueMap
             if (type[1] == 0x20) {
-                if (nbuf[0] != clen) error("valuemap length mismatch");
-                if (nbuf[1] != 1) error("valuemap pattern mismatch");
-                if (nbuf[3] != clen-0xc) error("valuemap content length mismatch");
-                uint32_t count = nbuf[2];
-                if (count > 0xff) error("count exceeded");
-                nbuf +=4;
                 if (!verify) {
                     bool map;
-                    if (strcasecmp(name, "ValueMap") == 0)
+                    if (known == MOF_NAME_VALUEMAP)
                         map = true;
-                    else if (strcasecmp(name, "Values") == 0)
+                    else if (known == MOF_NAME_VALUES)
                         map = false;
                     else
                         error("invalid valuemap");
 
                     if (map)
                     {
-                        valuemap = OSArray::withCapacity(count);
-                        vmap = OSDictionary::withCapacity(count);
-                        typeObj = OSString::withCString("Values");
-                        dict->setObject(name, typeObj);
-                        typeObj->release();
-                    }
-                    for (uint32_t i=0; i<count; i++) {
-                        switch (type[0]) {
-                            case MOF_STRING:
-                                nbuf = (uint32_t *)((uint16_t *)nbuf + parse_valuemap((uint16_t *)nbuf, map, i));
-                                break;
-                            case MOF_SINT32:
-                                nbuf += parse_valuemap((int32_t *)nbuf, map, i);
-                                break;
-                            default:
-                                break;
-                        }
-                        
-                    }
-                    if (!map)
-                    {
-                        dict->setObject(name, vmap);
-                        valuemap->release();
-                        vmap->release();
+                        // a ValueMap without Values is dropped
+                        OSSafeReleaseNULL(valuemap);
+                        OSSafeReleaseNULL(vmap);
+                        valuemap = OSArray::withCapacity(node->value.size);
+                        vmap = OSDictionary::withCapacity(node->value.size);
+                        dict->setObject(name, symbols.getLabel(MOF_UNKNOWN));
                     }
+                    else if (!valuemap)
+                        error("values without valuemap");
+                    // elements come through valueMapEntry, Values are set by parse_end
+                    f->name = name;
+                    f->map = map;
+                    f->stage = MOF_STAGE_VALUES;
                 }
             }
             else {
-            switch (type[0]) {
-                case MOF_BOOLEAN:
-                    if (!verify)
-                        dict->flushCollection();
-
-                    if (clen != 4 && clen != 2) {
-                        error("boolean length mismatch");
-                    }
-                    
-                    switch (clen == 4 ? nbuf[0] : nbuf[0] & 0xFFFF) {
-                        case 0:
-                            typeObj = kOSBooleanFalse;
-                            break;
-
-                        case 0xFFFF:
-                            typeObj = kOSBooleanTrue;
-                            break;
-
-                        default:
-                            error("invalid boolean");
-                            break;
-                    }
-                    break;
-
-                case MOF_STRING:
-                    if (!verify)
-                        dict->flushCollection();
-                    typeObj = OSString::withCString(parse_string((char *)nbuf, clen));
-                    break;
-
-                case MOF_SINT32:
-                    if (!verify)
-                        dict->flushCollection();
-                    if (clen != 4) error("sint32 length mismatch");
-                    typeObj = OSNumber::withNumber(nbuf[0], 32); // TODO: should be signed int here
-                    break;
-
-                default:
-                    errors("unexpected value type");
-                    typeObj = OSData::withBytes(nbuf, buf[0]-0x10-nlen);
-                    break;
-                }
+                // decoded by MOFIndex, boxed here for the dictionary
+                if (!verify && type[0] != MOF_OBJECT)
+                    dict->flushCollection();
+                typeObj = parse_value(&node->value);
+                if (!typeObj)
+                    return dict;
                 dict->setObject(name, typeObj);
                 typeObj->release();
             }
@@ -355,50 +299,18 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
     }
     // Method, or just a class with name?
     else {
-        char * name = parse_string((char *)(buf+5), nlen);
-        nbuf = (uint32_t *)((char *)nbuf + nlen);
-        if (nbuf[1] != 1) error("pattern mismatch");
-        uint32_t count = nbuf[2];
-        if (count > 0xff) error("count exceeded");
-        
-        nbuf+=4;
+        uint32_t count = 0;
+        while ((child = index.getChild(node, count)) && child->role == MOF_ROLE_PARAMETER)
+            count++;
 
+        // a single parameter class goes under the name, more in an array
         dict->flushCollection();
-        if (count == 1)
-        {
-            item = parse_class(nbuf);
-            dict->setObject(name, item);
-            item->release();
-            nbuf = (uint32_t *)((char *)nbuf + nbuf[0]);
-        }
-        else
-        {
-            OSArray *methods = OSArray::withCapacity(count);
-            for (uint32_t i=0; i<count; i++) {
-                item = parse_class(nbuf);
-                methods->setObject(item);
-                item->release();
-                nbuf = (uint32_t *)((char *)nbuf + nbuf[0]);
-            }
-            dict->setObject(name, methods);
-            methods->release();
-        }
-        
-        count = nbuf[1];
-        if (count > 0xff) error("count exceeded");
-        nbuf +=2;
-        OSDictionary *quaifiers = OSDictionary::withCapacity(count);
-        for (uint32_t i=0; i<count; i++) {
-            item = parse_method(nbuf);
-            quaifiers->merge(item);
-            item->release();
-            nbuf = (uint32_t *)((char *)nbuf + nbuf[0]);
-        }
-        dict->setObject("quaifiers", quaifiers);
-        quaifiers->release();
-        if (!parsed) return dict;
+        f->name = name;
+        f->params = count;
+        if (count != 1)
+            f->list = OSArray::withCapacity(count);
+        f->stage = MOF_STAGE_PARAMS;
     }
-    indent -=1;
     return dict;
 }
 
@@ -432,148 +344,97 @@ OSDictionary* MOF::parse_method(uint32_t *buf, uint32_t verify) {
 *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 
-OSDictionary* MOF::parse_class(uint32_t *buf) {
-    indent +=1;
-    OSDictionary *dict = OSDictionary::withCapacity(11);
-    uint32_t type = buf[1];
+OSDictionary* MOF::parse_class(mof_frame *f) {
+    const mof_node *node = f->node;
+    OSDictionary *dict = f->dict = OSDictionary::withCapacity(11);
+    uint32_t type = node->type;
     OSObject *typeObj;
-    OSDictionary *item;
-
-    switch (type) {
-        case 0:
-            typeObj = OSString::withCString("class");
-            break;
 
-        case 0xFFFFFFFF:
-            typeObj = OSString::withCString("parameter");
-            break;
-
-        default:
-            error("Wrong class type");
-            break;
-    }
+    // 0:class 1:parameter, layout is checked by MOFIndex
+    if (type)
+        typeObj = OSString::withCString("parameter");
+    else
+        typeObj = OSString::withCString("class");
     dict->setObject("type", typeObj);
     typeObj->release();
 
 #ifdef DEBUG
-    typeObj = OSNumber::withNumber(buf[0], 32);
+    typeObj = OSNumber::withNumber(node->length, 32);
     dict->setObject("length", typeObj);
     typeObj->release();
 #endif
-    
-    uint32_t count;
-    if (type && buf[2] != 0) error("Wrong class pattern");
-    if(buf[4] != 0 && buf[4] != 1) error("Wrong class type"); // 0:class 1:parameter
 
 #ifndef DEBUG
     dict->flushCollection();
 #endif
-    
-    buf += 5;
-    
+
+    // blocks are collected by the walk, see endBlock
+    f->block = OSDictionary::withCapacity(node->count);
     if (!type) {
         if (indent != 1) warning("wrong class level");
-        count = buf[1];
-        if (count > 0xff) error("count exceeded");
-        buf+=2;
-        OSDictionary *qualifiers = OSDictionary::withCapacity(count+3);
-        for (uint32_t i=0; i<count; i++) {
-            item = parse_method(buf);
-            qualifiers->merge(item);
-            item->release();
-            buf = (uint32_t *)((char *)buf + buf[0]);
-        }
-        if (!parsed) {
-            qualifiers->release();
-            return dict;
-        }
-
-        OSString * guid = OSDynamicCast(OSString, qualifiers->getObject("guid"));
-        if (!guid)
-            guid = OSDynamicCast(OSString, qualifiers->getObject("GUID"));
+        f->stage = MOF_STAGE_CLASS;
+    } else {
+        f->stage = MOF_STAGE_VARIABLES;
+    }
+    return dict;
+}
 
-        if (guid)
-        {
-            dict->setObject("GUID", guid);
-            char guid_string[37];
-            uuid_t guid_t;
-            switch (guid->getLength()) {
-                case 36:
-                    if (!uuid_parse(guid->getCStringNoCopy(), guid_t)) {
-                        uuid_unparse_lower(guid_t, guid_string);
-                        OSDictionary * entry = OSDynamicCast(OSDictionary, mData->getObject(guid_string));
-                        if (entry) {
-//                            entry->removeObject(kWMIEvaluate);
-                            entry->setObject("MOF", dict);
-//                            dict->setObject("WDG", entry);
-                        } else {
-                            IOLog("%d: GUID 36 not found %s", indent, guid_string);
-                        }
-                        typeObj = OSString::withCString(guid_string);
-                        dict->setObject("WDG", typeObj);
-                        typeObj->release();
-                        break;
-                    }
-                    
-                case 38:
-                    strncpy(guid_string, guid->getCStringNoCopy() + 1, 37);
-                    guid_string[36] = 0;
-                    if (!uuid_parse(guid_string, guid_t)) {
-                        uuid_unparse_lower(guid_t, guid_string);
-                        OSDictionary * entry = OSDynamicCast(OSDictionary, mData->getObject(guid_string));
-                        if (entry) {
-//                            entry->removeObject(kWMIEvaluate);
-//                            dict->setObject("WDG", entry);
-                            entry->setObject("MOF", dict);
-                        } else {
-                            IOLog("%d: GUID 38 not found %s", indent, guid_string);
-//                            typeObj = OSString::withCString(guid_string);
-//                            dict->setObject("WDG", typeObj);
-//                            typeObj->release();
-                        }
-                        typeObj = OSString::withCString(guid_string);
-                        dict->setObject("WDG", typeObj);
-                        typeObj->release();
-                        break;
-                    }
+// Qualifiers of a class are complete, false to stop at an error
+bool MOF::parse_qualifiers(mof_frame *f) {
+    OSDictionary *dict = f->dict;
+    OSDictionary *qualifiers = f->block;
+    OSObject *typeObj;
 
-                default:
-                    IOLog("%d: Unknown GUID format %d %s\n", indent, guid->getLength(), guid->getCStringNoCopy());
-                    break;
-            }
-        }
+    if (!parsed) return false;
 
-        switch (qualifiers->getCount()) {
-            case 0:
-                break;
-                
-            case 1:
-                if (qualifiers->getObject("abstract"))
-                {
-                    dict->merge(qualifiers);
-                    break;
-                }
+    OSString * guid = OSDynamicCast(OSString, qualifiers->getObject("guid"));
+    if (!guid)
+        guid = OSDynamicCast(OSString, qualifiers->getObject("GUID"));
 
-            default:
-                dict->setObject("qualifiers", qualifiers);
+    if (guid)
+    {
+        dict->setObject("GUID", guid);
+        char guid_string[37];
+        if (mof_guid(guid->getCStringNoCopy(), guid->getLength(), guid_string)) {
+            OSDictionary * entry = OSDynamicCast(OSDictionary, mData->getObject(guid_string));
+            if (entry) {
+//                entry->removeObject(kWMIEvaluate);
+//                dict->setObject("WDG", entry);
+                entry->setObject("MOF", dict);
+            } else {
+                IOLog("%d: GUID not found %s", indent, guid_string);
+            }
+            typeObj = OSString::withCString(guid_string);
+            dict->setObject("WDG", typeObj);
+            typeObj->release();
+        } else {
+            IOLog("%d: Unknown GUID format %d %s\n", indent, guid->getLength(), guid->getCStringNoCopy());
         }
-        qualifiers->release();
     }
 
-    count = buf[1];
-    if (count > 0xff) error("count exceeded");
-    buf+=2;
+    switch (qualifiers->getCount()) {
+        case 0:
+            break;
+            
+        case 1:
+            if (qualifiers->getObject("abstract"))
+            {
+                dict->merge(qualifiers);
+                break;
+            }
 
-    OSDictionary *variables = OSDictionary::withCapacity(count);
-    for (uint32_t i=0; i<count; i++) {
-        item = parse_method(buf);
-        variables->merge(item);
-        item->release();
-        buf = (uint32_t *)((char *)buf + buf[0]);
+        default:
+            dict->setObject("qualifiers", qualifiers);
     }
+    return true;
+}
 
+// Variables of a class are complete, false to stop at an error
+bool MOF::parse_variables(mof_frame *f) {
+    OSDictionary *dict = f->dict;
+    OSDictionary *variables = f->block;
     OSObject * val;
-    count = 4;
+    uint32_t count = 4;
     char const *property[4];
     property[0] = "__CLASS";
     property[1] = "__NAMESPACE";
@@ -589,33 +450,241 @@ OSDictionary* MOF::parse_class(uint32_t *buf) {
     }
     if (variables->getCount() != 0)
     {
-        if (variables->getCount() == 1 && type)
+        if (variables->getCount() == 1 && f->node->type)
             dict->merge(variables);
         else
             dict->setObject("variables", variables);
     }
-    variables->release();
+    return parsed;
+}
 
-    if (!parsed) return dict;
+// A block of f->node is complete, SKIP to stop at an error
+int MOF::endBlock(const mof_node *node, uint8_t role) {
+    mof_frame *f = &frames[indent-1];
+    OSDictionary *dict = f->dict;
 
-    count = buf[1];
-    if (count > 0xff) error("count exceeded");
-    buf+=2;
-    OSDictionary *methods = OSDictionary::withCapacity(count);
-    for (uint32_t i=0; i<count; i++) {
-        item = parse_method(buf);
-        methods->merge(item);
-        item->release();
-        buf = (uint32_t *)((char *)buf + buf[0]);
+    switch (f->stage) {
+        case MOF_STAGE_OBJECT:
+            dict->flushCollection();
+            dict->setObject(f->name, f->block);
+            break;
+
+        case MOF_STAGE_PARAMS:
+            if (f->list) {
+                dict->setObject(f->name, f->list);
+                OSSafeReleaseNULL(f->list);
+            }
+            f->block = OSDictionary::withCapacity(node->count - f->params);
+            f->stage = MOF_STAGE_QUALIFIERS;
+            return MOF_VISIT_CONTINUE;
+
+        case MOF_STAGE_QUALIFIERS:
+            dict->setObject("quaifiers", f->block);
+            break;
+
+        // blocks of a class, the stage is the role of its children
+        case MOF_STAGE_CLASS:
+        case MOF_STAGE_VARIABLES:
+            if (f->stage == MOF_STAGE_CLASS ? !parse_qualifiers(f) : !parse_variables(f))
+                return MOF_VISIT_SKIP;
+            f->block->release();
+            f->block = OSDictionary::withCapacity(node->count);
+            f->stage = f->stage == MOF_STAGE_CLASS ? MOF_STAGE_VARIABLES : MOF_STAGE_METHODS;
+            return MOF_VISIT_CONTINUE;
+
+        case MOF_STAGE_METHODS:
+            if (f->block->getCount() != 0)
+                dict->setObject(node->type ? "parameters" : "methods", f->block);
+            break;
+
+        default:
+            return MOF_VISIT_SKIP;
     }
-    if (methods->getCount() != 0)
-        dict->setObject(type ? "parameters" : "methods", methods);
-    if (!parsed) return dict;
+    OSSafeReleaseNULL(f->block);
+    OSSafeReleaseNULL(f->list);
+    f->stage = MOF_STAGE_DONE;
+    return MOF_VISIT_CONTINUE;
+}
+
+int MOF::valueMapEntry(const mof_node *node, uint32_t i, const mof_value *value) {
+    parse_valuemap(&frames[indent-1], i, value);
+    return MOF_VISIT_CONTINUE;
+}
+
+// New frame for a node the walk entered
+int MOF::beginClass(const mof_node *node) {
+    mof_frame *f = &frames[indent++];
+
+    stats.nodes++;
+    memset(f, 0, sizeof(mof_frame));
+    f->node = node;
+    parse_class(f);
+    verify = 0;
+    return MOF_VISIT_CONTINUE;
+}
+
+int MOF::parse_item(const mof_node *node) {
+    mof_frame *f = &frames[indent++];
+
+    stats.nodes++;
+    memset(f, 0, sizeof(mof_frame));
+    f->node = node;
+    parse_method(f, verify);
+    verify = 0;
+    // nothing more to collect after an error or for a scalar
+    return f->stage != MOF_STAGE_DONE ? MOF_VISIT_CONTINUE : MOF_VISIT_SKIP;
+}
+
+// Frame is complete, hand its dictionary to the parent
+int MOF::parse_end() {
+    mof_frame *f = &frames[--indent];
+    OSDictionary *item = f->dict;
+
+    if (f->stage == MOF_STAGE_VALUES && !f->map) {
+        f->dict->setObject(f->name, vmap);
+        OSSafeReleaseNULL(valuemap);
+        OSSafeReleaseNULL(vmap);
+    }
+    OSSafeReleaseNULL(f->block);
+    OSSafeReleaseNULL(f->list);
+    f->stage = MOF_STAGE_DONE;
+    if (indent == 0) {
+        result = item;
+        return MOF_VISIT_CONTINUE;
+    }
+
+    f = &frames[indent-1];
+    if (f->list)
+        f->list->setObject(item);
+    else if (f->stage == MOF_STAGE_PARAMS)
+        f->dict->setObject(f->name, item);
+    else
+        f->block->merge(item);
+    item->release();
+    return MOF_VISIT_CONTINUE;
+}
+
+/*
+ * Same outcome as the verify steps of parse_method for an item that parsed
+ * without errors before: true when it matches the flavor type and would
+ * not be marked "verified" false.
+ */
+bool MOF::parse_verified(const mof_node *node, uint32_t verify) {
+    const mof_symbol *sym;
+
+    switch (verify) {
+        case MOF_OFFSET_BOOLEAN:
+        case MOF_OFFSET_OBJECT:
+            break;
+
+        case MOF_OFFSET_STRING:
+            if (node->type == MOF_STRING) break;
+
+        case MOF_OFFSET_SINT32:
+            if (node->type == MOF_SINT32) break;
+
+        default:
+            return false;
+    }
+    if (node->kind != MOF_NODE_VALUE)
+        return true;
+
+    // seen in the class pass, so no allocation here
+    sym = symbols.intern(node->name, node->nlen);
+    if (!sym)
+        return false;
+    switch (verify) {
+        case MOF_OFFSET_STRING:
+            if (sym->known == MOF_NAME_CIMTYPE) return true;
 
-    indent -=1;
+        case MOF_OFFSET_SINT32:
+            return sym->known == MOF_NAME_ID;
+
+        default:
+            return true;
+    }
+}
+
+/*
+ * Builds the dictionary of node and everything below it. MOF is the
+ * visitor that turns the walk into dictionaries, one frame per node on
+ * the MOF_MAX_DEPTH frames from the arena, so kernel stack use stays the
+ * same for any nesting.
+ */
+OSDictionary* MOF::parse_node(const mof_node *node, uint32_t verify) {
+    this->verify = verify;
+    result = nullptr;
+    indent = 0;
+    // cut short only past MOF_MAX_DEPTH, which MOFIndex never indexes
+    if (!walk(&index, node))
+        parsed = false;
+    return result;
+}
+
+// Class i, its nodes are counted in stats
+OSDictionary* MOF::parse_class_at(uint32_t i) {
+    uint32_t nodes = stats.nodes;
+    OSDictionary *dict = parse_node(index.getNode(1+i));
+
+    nodes = stats.nodes - nodes;
+    if (nodes > stats.maxNodes)
+        stats.maxNodes = nodes;
+    stats.classes++;
     return dict;
 }
 
+/*
+ * Counts what a release of obj would free, except shared symbols and
+ * booleans. An object held twice below obj, like a guid string, counts
+ * twice. Sizes are estimated from the count, collections may have more
+ * capacity than that.
+ */
+void MOF::measure(const OSObject *obj, uint32_t *objects, uint32_t *bytes, uint32_t depth) {
+    const OSString *str;
+    const OSData *data;
+    const OSArray *array;
+    const OSDictionary *dict;
+
+    // dictionaries nest about twice as deep as the nodes they are built from
+    if (!obj || depth > 2 * MOF_MAX_DEPTH || OSDynamicCast(OSSymbol, obj) || OSDynamicCast(OSBoolean, obj))
+        return;
+    (*objects)++;
+    if ((str = OSDynamicCast(OSString, obj))) {
+        *bytes += sizeof(OSString) + str->getLength() + 1;
+    } else if (OSDynamicCast(OSNumber, obj)) {
+        *bytes += sizeof(OSNumber);
+    } else if ((data = OSDynamicCast(OSData, obj))) {
+        *bytes += sizeof(OSData) + data->getLength();
+    } else if ((array = OSDynamicCast(OSArray, obj))) {
+        *bytes += sizeof(OSArray) + array->getCount() * sizeof(void *);
+        for (uint32_t i=0; i<array->getCount(); i++)
+            measure(array->getObject(i), objects, bytes, depth + 1);
+    } else if ((dict = OSDynamicCast(OSDictionary, obj))) {
+        // keys are symbols, shared with every other dictionary
+        *bytes += sizeof(OSDictionary) + dict->getCount() * 2 * sizeof(void *);
+        OSCollectionIterator *it = OSCollectionIterator::withCollection(dict);
+        if (!it)
+            return;
+        while (const OSSymbol *key = OSDynamicCast(OSSymbol, it->getNextObject()))
+            measure(dict->getObject(key), objects, bytes, depth + 1);
+        it->release();
+    } else {
+        *bytes += sizeof(OSObject);
+    }
+}
+
+// Heap is what the MOF holds now, the arena keeps its figures after release
+const mof_stats &MOF::getStats() {
+    const mof_arena_stats &scratch = arena.getStats();
+
+    stats.heap = size + (uint32_t)own.getMemory() + (uint32_t)symbols.getMemory() +
+                 nclasses * sizeof(mof_class) + scratch.heap;
+    stats.peak = scratch.peak;
+    stats.names = symbols.getStats().symbols;
+    stats.nameBytes = symbols.getStats().bytes;
+    return stats;
+}
+
 /*
 *    0                   1                   2                   3
 *    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -642,17 +711,25 @@ OSDictionary* MOF::parse_class(uint32_t *buf) {
 *   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 OSObject* MOF::parse_bmf(char * bmf_guid_string) {
+    OSObject *result = parse_full(bmf_guid_string);
+
+    measure(result, &stats.objects, &stats.bytes);
+    return result;
+}
+
+OSObject* MOF::parse_full(char * bmf_guid_string) {
     parsed = true;
     indent = 0;
 
-    uint32_t *nbuf = (uint32_t *)buf;
+    // released with the rest of the arena, scopes only rewind past it
+    frames = (mof_frame *)arena.alloc(MOF_MAX_DEPTH * sizeof(mof_frame));
+    if (!frames) return OSString::withCString("parse error");
 
-    if (nbuf[0] != 0x424D4F46) errors("header mismatch");
-    if (nbuf[2] != 1 | nbuf[3] != 1) errors("pattern mismatch");
+    if (!index.begin()) errors("invalid header");
     
     if (!parsed) return OSString::withCString("parse error");
     
-    uint32_t count = nbuf[4];
+    uint32_t count = index.getClasses();
     OSDictionary *dict = OSDictionary::withCapacity(5+count);
     OSObject *typeObj;
     OSDictionary *item;
@@ -672,15 +749,16 @@ OSObject* MOF::parse_bmf(char * bmf_guid_string) {
     typeObj->release();
 
 #ifdef DEBUG
-    typeObj = OSNumber::withNumber(nbuf[1], 32);
+    typeObj = OSNumber::withNumber(index.read32(4), 32);
     dict->setObject("length", typeObj);
     typeObj->release();
 #endif
 
-    nbuf+=5;
-    if (count > 0xff) error("count exceeded");
     for (uint32_t i=0; i<count; i++) {
-        item = parse_class(nbuf);
+        uint32_t length = index.nextLength();
+        if (length < 0x14 || length > size-index.nextOffset()) error("class length exceeded");
+        if (!index.addClass()) error("invalid class");
+        item = parse_class_at(i);
         OSString * name = OSDynamicCast(OSString, item->getObject("__CLASS"));
         if (!name) {
             char res[10];
@@ -691,25 +769,27 @@ OSObject* MOF::parse_bmf(char * bmf_guid_string) {
         else
             dict->setObject(name, item);
         item->release();
-        nbuf = (uint32_t *)((char *)nbuf + nbuf[0]);
     }
     if (!parsed) return dict;
+
+    if (!index.end()) error("footer mismatch");
     
-    if (nbuf[0] != 0x464F4D42 | nbuf[1] != 0x4C415551 | nbuf[2] != 0x56414C46 | nbuf[3] != 0x3131524F)  error("footer mismatch");
-    
-    count = nbuf[4];
-    nbuf += 5;
-    if (count > 0x1ff) error("count exceeded");
+    count = index.getFlavors();
     OSArray *offsets = OSArray::withCapacity(count);
     for (uint32_t i=0; i<count; i++) {
-        item = parse_method((uint32_t *)(buf+nbuf[0]), nbuf[1]);
+        const mof_node *flavor = index.getFlavor(i);
+        const mof_node *node = index.getChild(flavor, 0);
+        // the class pass already parsed it, a dictionary is only needed for the list
+        if (node->role != MOF_ROLE_FLAVOR && parse_verified(node, flavor->type))
+            continue;
+        item = parse_node(node, flavor->type);
         if (item->getObject("verified") != NULL)
         {
             OSDictionary *offset = OSDictionary::withCapacity(3);
-            typeObj = OSNumber::withNumber(nbuf[0], 32);
+            typeObj = OSNumber::withNumber(flavor->offset, 32);
             offset->setObject("address", typeObj);
             typeObj->release();
-            switch (nbuf[1]) {
+            switch (flavor->type) {
                 case MOF_OFFSET_BOOLEAN:
                     typeObj = OSString::withCString("BOOLEAN");
                     break;
@@ -737,10 +817,114 @@ OSObject* MOF::parse_bmf(char * bmf_guid_string) {
             offset->release();
         }
         item->release();
-        nbuf += 2;
     }
     if (offsets->getCount() != 0)
         dict->setObject("offsets", offsets);
     offsets->release();
+    arena.release();
     return dict;
 }
+
+/*
+ * Lazy mode: indexes the whole buffer, unless the index is shared, and notes the GUID
+ * of each class, dictionaries are built by getClass on first use. Flavor
+ * offsets are not parsed.
+ */
+bool MOF::index_bmf(char * bmf_guid_string) {
+    const mof_node *node, *guid;
+    char guid_string[40];
+    uint32_t len;
+
+    parsed = true;
+    indent = 0;
+
+    frames = (mof_frame *)arena.alloc(MOF_MAX_DEPTH * sizeof(mof_frame));
+    if (!frames) errors("allocation failed");
+    if (!parsed) return false;
+    if (&index == &own && !index.build()) errors("invalid index");
+    if (!parsed) return false;
+
+    if (index.getClasses()) {
+        classes = (mof_class *)IOMalloc(index.getClasses() * sizeof(mof_class));
+        if (!classes) {
+            errors("allocation failed");
+            return false;
+        }
+        nclasses = index.getClasses();
+        memset(classes, 0, nclasses * sizeof(mof_class));
+    }
+    for (uint32_t i=0; i<nclasses; i++) {
+        node = index.getNode(1+i);
+        guid = index.findChild(node, "guid", MOF_ROLE_QUALIFIER);
+        if (!guid)
+            guid = index.findChild(node, "GUID", MOF_ROLE_QUALIFIER);
+        if (!guid || guid->kind != MOF_NODE_VALUE || guid->type != MOF_STRING || guid->flags)
+            continue;
+        len = index.getString(guid->value.span.offset, guid->value.span.len, guid_string, sizeof(guid_string));
+        if (len >= sizeof(guid_string) || !mof_guid(guid_string, len, classes[i].guid))
+            IOLog("%d: Unknown GUID format %d %s\n", indent, len, guid_string);
+    }
+
+    OSDictionary * entry = OSDynamicCast(OSDictionary, mData->getObject(bmf_guid_string));
+    if (entry) {
+        OSString *typeObj = OSString::withCString("base");
+        entry->setObject("MOF", typeObj);
+        typeObj->release();
+    } else {
+        IOLog("%d: MOF GUID not found %s", indent, bmf_guid_string);
+    }
+    return true;
+}
+
+// Dictionary of class i, built once, an error does not affect other classes
+OSDictionary* MOF::parse_lazy(uint32_t i) {
+    bool ok = parsed;
+
+    if (!classes[i].dict) {
+        parsed = true;
+        classes[i].dict = parse_class_at(i);
+        measure(classes[i].dict, &stats.objects, &stats.bytes);
+        if (!parsed)
+            IOLog("%d: class %d parsed with errors\n", indent, i);
+        parsed = ok && parsed;
+    }
+    return classes[i].dict;
+}
+
+bool MOF::findClass(const char *guid, uint32_t *i) {
+    if (!guid[0])
+        return false;
+    for (*i=0; *i<nclasses; (*i)++)
+        if (!strcmp(classes[*i].guid, guid))
+            return true;
+    return false;
+}
+
+OSDictionary* MOF::getClass(const char *guid) {
+    uint32_t i;
+
+    return findClass(guid, &i) ? parse_lazy(i) : nullptr;
+}
+
+// Lazy mode, streams class i to v without building its dictionary
+bool MOF::visitClassAt(uint32_t i, MOFVisitor *v) {
+    return i < nclasses && v->walk(&index, index.getNode(1+i));
+}
+
+bool MOF::visitClass(const char *guid, MOFVisitor *v) {
+    uint32_t i;
+
+    return findClass(guid, &i) && v->walk(&index, index.getNode(1+i));
+}
+
+OSDictionary* MOF::getClassNamed(const char *name) {
+    const mof_node *node;
+
+    for (uint32_t i=0; i<nclasses; i++) {
+        node = index.findChild(index.getNode(1+i), "__CLASS", MOF_ROLE_VARIABLE);
+        if (node && node->kind == MOF_NODE_VALUE && node->type == MOF_STRING && !node->flags &&
+            index.stringEquals(node->value.span.offset, node->value.span.len, name))
+            return parse_lazy(i);
+    }
+    return nullptr;
+}
@@ -13,57 +13,132 @@
 #define bmfparser_hpp
 
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
+#include "bmfdec.h"
+#include "bmfindex.hpp"
+#include "bmfarena.hpp"
+#include "bmfutf.h"
+#include "bmfsymbol.hpp"
+#include "bmfvisitor.hpp"
 
 #define kWMIEvaluate "evaluated"
 
-enum mof_offset_type {
-  MOF_OFFSET_UNKNOWN,
-  MOF_OFFSET_BOOLEAN = 0x01,
-  MOF_OFFSET_OBJECT = 0x02,
-  MOF_OFFSET_STRING = 0x03,
-  MOF_OFFSET_SINT32 = 0x11,
+// What a frame of MOF::parse_node collects next
+enum mof_stage {
+    MOF_STAGE_DONE,
+    MOF_STAGE_CLASS = MOF_ROLE_QUALIFIER,   // class blocks, same value as the role
+    MOF_STAGE_VARIABLES = MOF_ROLE_VARIABLE,
+    MOF_STAGE_METHODS = MOF_ROLE_METHOD,
+    MOF_STAGE_OBJECT = 0x10,                // qualifiers of an object
+    MOF_STAGE_PARAMS,                       // parameter classes of a method
+    MOF_STAGE_QUALIFIERS,                   // qualifiers of a method
+    MOF_STAGE_VALUES,                       // elements of a ValueMap or Values
 };
 
+// Node being built, its children are parsed in between
+struct mof_frame {
+    const mof_node *node;
+    OSDictionary *dict;         // result
+    OSDictionary *block;        // merged children
+    OSArray *list;              // parameter classes, unless there is one
+    const OSSymbol *name;
+    uint32_t params;            // parameter classes of a method
+    uint8_t stage;              // mof_stage
+    bool map;                   // ValueMap rather than Values
+};
+
+// Class noted by MOF::index_bmf
+struct mof_class {
+    char guid[37];              // lower case, empty without a guid qualifier
+    OSDictionary *dict;         // built on first use
+};
 
-enum mof_data_type {
-  MOF_UNKNOWN,
-  MOF_SINT16 = 0x02, // Unused
-  MOF_SINT32 = 0x03,
-  MOF_STRING = 0x08,
-  MOF_BOOLEAN = 0x0B,
-  MOF_OBJECT = 0x0D,
-  MOF_SINT8 = 0x10, // Unused
-  MOF_UINT8 = 0x11, // Unused
-  MOF_UINT16 = 0x12, // Unused
-  MOF_UINT32 = 0x13, // Unused
-  MOF_SINT64 = 0x14, // Unused
-  MOF_UINT64 = 0x15, // Unused
-  MOF_DATETIME = 0x65, // Unused
+// What the dictionaries of a MOF cost, see MOF::getStats
+struct mof_stats {
+    uint32_t objects;   // objects of the dictionaries built, without their keys
+    uint32_t bytes;     // estimated bytes of those objects
+    uint32_t names;     // keys, one symbol per distinct name
+    uint32_t nameBytes; // estimated bytes of the keys and type labels
+    uint32_t heap;      // buffer, index, names table, class table and scratch chunks
+    uint32_t peak;      // most scratch bytes in use at once
+    uint32_t classes;   // class dictionaries built
+    uint32_t nodes;     // index nodes turned into dictionaries
+    uint32_t maxNodes;  // nodes of the largest class built
 };
 
-class MOF {
+// Dictionaries are built as a visitor of the index walk
+class MOF : public MOFVisitor {
     
 public:
-    MOF(char *data, uint32_t size, OSDictionary *mData) {buf = data; this->size = size; this->mData = mData;};
+    MOF(char *data, uint32_t size, OSDictionary *mData) : own(data, size), index(own), symbols(data) {buf = data; this->size = size; this->mData = mData;};
+    // Lazy mode on an index built by the caller, read only so MOFs on other threads may share it
+    MOF(char *data, uint32_t size, OSDictionary *mData, MOFIndex *shared) : own(data, 0), index(*shared), symbols(data) {buf = data; this->size = size; this->mData = mData;};
     MOF();
+    ~MOF();
 //    OSObject* parse_bmf(uuid_t bmf_guid);
     OSObject* parse_bmf(char * bmf_guid_string);
+    // Lazy mode, classes are parsed when looked up
+    bool index_bmf(char * bmf_guid_string);
+    OSDictionary* getClass(const char *guid);
+    OSDictionary* getClassNamed(const char *name);
+    uint32_t getClassCount() {return nclasses;};
+    OSDictionary* getClassAt(uint32_t i) {return i < nclasses ? parse_lazy(i) : nullptr;};
+    // Lower case, empty when class i has no guid qualifier
+    const char* getClassGUID(uint32_t i) {return i < nclasses ? classes[i].guid : nullptr;};
+    // Lazy mode, streams a class without building it, false when v stopped
+    bool visitClass(const char *guid, MOFVisitor *v);
+    bool visitClassAt(uint32_t i, MOFVisitor *v);
     bool parsed;
+    // Scratch allocations of the last parse, see MOFArena
+    const mof_arena_stats &getArenaStats() {return arena.getStats();};
+    const mof_symbol_stats &getSymbolStats() {return symbols.getStats();};
+    // Totals so far, classes built later in lazy mode are added as they are
+    const mof_stats &getStats();
+    // Objects and estimated bytes below obj, shared symbols and booleans are not counted
+    static void measure(const OSObject *obj, uint32_t *objects, uint32_t *bytes, uint32_t depth = 0);
 private:
     char *parse_string(char *buf, uint32_t size);
-    uint16_t parse_valuemap(uint16_t *buf, bool map, uint32_t i);
-    uint32_t parse_valuemap(int32_t *buf, bool map, uint32_t i);
+    void parse_valuemap(mof_frame *f, uint32_t i, const mof_value *element);
+    OSObject* parse_value(const mof_value *value);
 
-    OSDictionary* parse_class(uint32_t *buf);
-    OSDictionary* parse_method(uint32_t *buf, uint32_t verify = 0);
+    // OSDictionary output from the index, for registry publishing
+    OSDictionary* parse_node(const mof_node *node, uint32_t verify = 0);
+    virtual int beginClass(const mof_node *node) APPLE_KEXT_OVERRIDE;
+    virtual int endClass(const mof_node *node) APPLE_KEXT_OVERRIDE {return parse_end();};
+    virtual int qualifier(const mof_node *node) APPLE_KEXT_OVERRIDE {return parse_item(node);};
+    virtual int property(const mof_node *node) APPLE_KEXT_OVERRIDE {return parse_item(node);};
+    virtual int method(const mof_node *node) APPLE_KEXT_OVERRIDE {return parse_item(node);};
+    virtual int endItem(const mof_node *node) APPLE_KEXT_OVERRIDE {return parse_end();};
+    virtual int endBlock(const mof_node *node, uint8_t role) APPLE_KEXT_OVERRIDE;
+    virtual int valueMapEntry(const mof_node *node, uint32_t i, const mof_value *value) APPLE_KEXT_OVERRIDE;
+    int parse_item(const mof_node *node);
+    int parse_end();
+    OSDictionary* parse_class(mof_frame *f);
+    bool parse_qualifiers(mof_frame *f);
+    bool parse_variables(mof_frame *f);
+    OSDictionary* parse_method(mof_frame *f, uint32_t verify);
+    OSDictionary* parse_lazy(uint32_t i);
+    OSDictionary* parse_class_at(uint32_t i);
+    OSObject* parse_full(char * bmf_guid_string);
+    bool findClass(const char *guid, uint32_t *i);
+    bool parse_verified(const mof_node *node, uint32_t verify);
 
     int indent;
 
     char * buf;
     uint32_t size;
-    OSArray* valuemap;
-    OSDictionary *vmap;
+    MOFIndex own;
+    MOFIndex &index;            // own, or shared and already built
+    MOFArena arena;
+    MOFSymbols symbols;
+    mof_frame *frames {nullptr};
+    uint32_t verify {0};        // flavor type of the root of parse_node
+    OSDictionary *result {nullptr};
+    mof_class *classes {nullptr};
+    uint32_t nclasses {0};
+    OSArray* valuemap {nullptr};
+    OSDictionary *vmap {nullptr};
     OSDictionary *mData;
+    mof_stats stats {};
 };
 
 #endif /* bmfparser_hpp */
@@ -0,0 +1,121 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfsymbol.cpp
+//  YogaSMC
+//
+//  Interned names and type labels of a MOF buffer.
+//
+
+#include "bmfsymbol.hpp"
+#include "bmfindex.hpp"
+#include "bmfutf.h"
+
+MOFSymbols::~MOFSymbols() {
+    for (uint32_t i=0; i<capacity; i++)
+        OSSafeReleaseNULL(table[i].name);
+    if (table)
+        IOFree(table, capacity * sizeof(mof_symbol));
+    for (int i=0; i<MOF_LABELS; i++)
+        OSSafeReleaseNULL(labels[i]);
+}
+
+// Keeps the load at or below one half
+bool MOFSymbols::grow() {
+    uint32_t cap = capacity ? capacity * 2 : 64, i, j;
+    mof_symbol *t = (mof_symbol *)IOMalloc(cap * sizeof(mof_symbol));
+
+    if (!t)
+        return false;
+    memset(t, 0, cap * sizeof(mof_symbol));
+    for (i=0; i<capacity; i++) {
+        if (!table[i].name)
+            continue;
+        for (j = table[i].hash & (cap - 1); t[j].name; j = (j + 1) & (cap - 1));
+        t[j] = table[i];
+    }
+    if (table)
+        IOFree(table, capacity * sizeof(mof_symbol));
+    table = t;
+    capacity = cap;
+    return true;
+}
+
+const mof_symbol *MOFSymbols::intern(uint32_t offset, uint16_t nlen) {
+    const uint8_t *p = buf + offset;
+    uint32_t hash = 2166136261U, i, len;
+    mof_symbol *s;
+    char small[64], *name;
+
+    // FNV-1a
+    for (i=0; i<nlen; i++)
+        hash = (hash ^ p[i]) * 16777619U;
+
+    if (stats.symbols * 2 >= capacity && !grow())
+        return nullptr;
+    for (i = hash & (capacity - 1); table[i].name; i = (i + 1) & (capacity - 1)) {
+        s = &table[i];
+        if (s->hash == hash && s->nlen == nlen && !memcmp(buf + s->offset, p, nlen)) {
+            stats.hits++;
+            return s;
+        }
+    }
+
+    len = mof_utf8_len(p, nlen / 2);
+    name = len < sizeof(small) ? small : (char *)IOMalloc(len + 1);
+    if (!name)
+        return nullptr;
+    mof_utf16_to_utf8(p, nlen / 2, name, len + 1);
+
+    s = &table[i];
+    s->name = OSSymbol::withCString(name);
+    s->hash = hash;
+    s->offset = offset;
+    s->nlen = nlen;
+    if (strcmp(name, "ID") == 0)
+        s->known = MOF_NAME_ID;
+    else if (strcmp(name, "CIMTYPE") == 0)
+        s->known = MOF_NAME_CIMTYPE;
+    else if (strcasecmp(name, "Dynamic") == 0)
+        s->known = MOF_NAME_DYNAMIC;
+    else if (strcasecmp(name, "ValueMap") == 0)
+        s->known = MOF_NAME_VALUEMAP;
+    else if (strcasecmp(name, "Values") == 0)
+        s->known = MOF_NAME_VALUES;
+    else
+        s->known = MOF_NAME_OTHER;
+    if (name != small)
+        IOFree(name, len + 1);
+    if (!s->name)
+        return nullptr;
+    stats.symbols++;
+    stats.bytes += sizeof(OSSymbol) + len + 1;
+    return s;
+}
+
+const OSSymbol *MOFSymbols::getLabel(uint8_t type) {
+    static const char *names[MOF_LABELS] = {"Values", "BOOLEAN", "STRING", "SINT32", "OBJECT", "UINT8", "UINT32",
+                                            "SINT8", "SINT16", "UINT16", "SINT64", "UINT64", "DATETIME"};
+    int i;
+
+    switch (type) {
+        case MOF_BOOLEAN: i = 1; break;
+        case MOF_STRING: i = 2; break;
+        case MOF_SINT32: i = 3; break;
+        case MOF_OBJECT: i = 4; break;
+        case MOF_UINT8: i = 5; break;
+        case MOF_UINT32: i = 6; break;
+        case MOF_SINT8: i = 7; break;
+        case MOF_SINT16: i = 8; break;
+        case MOF_UINT16: i = 9; break;
+        case MOF_SINT64: i = 10; break;
+        case MOF_UINT64: i = 11; break;
+        case MOF_DATETIME: i = 12; break;
+        case MOF_UNKNOWN: i = 0; break;
+        default: return nullptr;
+    }
+    if (labels[i])
+        stats.labels++;
+    else if ((labels[i] = OSSymbol::withCString(names[i])))
+        stats.bytes += sizeof(OSSymbol) + strlen(names[i]) + 1;
+    return labels[i];
+}
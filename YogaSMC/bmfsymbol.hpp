@@ -0,0 +1,69 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfsymbol.hpp
+//  YogaSMC
+//
+//  Interned names and type labels of a MOF buffer.
+//
+
+#ifndef bmfsymbol_hpp
+#define bmfsymbol_hpp
+
+#include <IOKit/acpi/IOACPIPlatformDevice.h>
+
+// Names the parser looks for, resolved once per distinct name
+enum mof_known_name {
+    MOF_NAME_OTHER,
+    MOF_NAME_ID,        // "ID", exact
+    MOF_NAME_CIMTYPE,   // "CIMTYPE", exact
+    MOF_NAME_DYNAMIC,   // "Dynamic", any case
+    MOF_NAME_VALUEMAP,  // "ValueMap", any case
+    MOF_NAME_VALUES,    // "Values", any case
+};
+
+#define MOF_LABELS 13   // "Values" and each mof_data_type
+
+struct mof_symbol {
+    const OSSymbol *name;
+    uint32_t hash;
+    uint32_t offset;    // first occurrence, UTF-16LE in the buffer
+    uint16_t nlen;
+    uint8_t known;      // mof_known_name
+};
+
+struct mof_symbol_stats {
+    uint32_t symbols;   // distinct names
+    uint32_t hits;      // names resolved without decoding
+    uint32_t labels;    // type labels shared
+    uint32_t bytes;     // estimated bytes of the symbols and labels
+};
+
+/*
+ * Open addressing on the raw UTF-16LE bytes of a name span, so a name
+ * is decoded and turned into an OSSymbol the first time only. Names
+ * match case-sensitively, like the dictionary keys they become.
+ */
+class MOFSymbols {
+
+public:
+    MOFSymbols(const char *data) {buf = (const uint8_t *)data;};
+    ~MOFSymbols();
+
+    // Valid until the next intern, nullptr when out of memory
+    const mof_symbol *intern(uint32_t offset, uint16_t nlen);
+    // Shared label of a mof_data_type, MOF_UNKNOWN gives "Values"
+    const OSSymbol *getLabel(uint8_t type);
+    const mof_symbol_stats &getStats() {return stats;};
+    size_t getMemory() {return capacity * sizeof(mof_symbol);};
+
+private:
+    bool grow();
+
+    const uint8_t *buf;
+    mof_symbol *table {nullptr};
+    uint32_t capacity {0};
+    const OSSymbol *labels[MOF_LABELS] {};
+    mof_symbol_stats stats {};
+};
+
+#endif /* bmfsymbol_hpp */
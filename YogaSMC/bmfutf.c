@@ -0,0 +1,212 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfutf.c
+//  YogaSMC
+//
+//  UTF-16LE to UTF-8 for MOF names and strings.
+//
+//  Almost every MOF string is ASCII, so both passes check eight units
+//  at a time with two 64-bit words and only drop to the per-unit path
+//  for a block holding a NUL or a unit above 0x7F. The kernel gives us
+//  no SSE state, so the words are plain integer registers.
+//
+
+#include "bmfutf.h"
+#include <IOKit/IOLib.h>
+
+#define INLINE static inline
+
+#define UTF_HI  0xFF80FF80FF80FF80ULL   // bits set in any non-ASCII unit
+#define UTF_7F  0x007F007F007F007FULL
+#define UTF_80  0x0080008000800080ULL
+
+INLINE uint64_t utf_ld64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+INLINE uint16_t utf_ld16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+// Eight units with neither NUL nor anything above 0x7F
+INLINE int utf_ascii8(const uint8_t *p)
+{
+    uint64_t a = utf_ld64(p), b = utf_ld64(p + 8);
+    // adding 0x7F to a unit below 0x80 sets bit 7 unless the unit is 0
+    return !((a | b) & UTF_HI) && ((a + UTF_7F) & (b + UTF_7F) & UTF_80) == UTF_80;
+}
+
+// Four units, the tail of most identifiers
+INLINE int utf_ascii4(uint64_t a)
+{
+    return !(a & UTF_HI) && ((a + UTF_7F) & UTF_80) == UTF_80;
+}
+
+// Low bytes of four ASCII units
+INLINE uint32_t utf_pack4(uint64_t v)
+{
+    v = (v | v >> 8) & 0x0000FFFF0000FFFFULL;
+    return (uint32_t)(v | v >> 16);
+}
+
+INLINE void utf_st32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/*
+ * Length of the code point at src[i], sets *n to the units it takes,
+ * 0 at the end of the string.
+ */
+INLINE uint32_t utf_one(const uint8_t *src, uint32_t i, uint32_t units, uint32_t *n)
+{
+    uint16_t u = utf_ld16(src + 2 * i), v;
+
+    *n = 1;
+    if (u == 0) {
+        *n = 0;
+        return 0;
+    }
+    if (u < 0x80)
+        return 1;
+    if (u < 0x800)
+        return 2;
+    if (u >= 0xD800 && u <= 0xDBFF && i + 1 < units) {
+        v = utf_ld16(src + 2 * i + 2);
+        if (v >= 0xDC00 && v <= 0xDFFF) {
+            *n = 2;
+            return 4;
+        }
+    }
+    return 3;
+}
+
+INLINE void utf_put(const uint8_t *src, uint32_t i, uint32_t k, uint8_t *out)
+{
+    uint32_t c = utf_ld16(src + 2 * i);
+
+    switch (k) {
+        case 1:
+            out[0] = c;
+            break;
+        case 2:
+            out[0] = 0xC0 | (c >> 6);
+            out[1] = 0x80 | (c & 0x3F);
+            break;
+        case 3:
+            out[0] = 0xE0 | (c >> 12);
+            out[1] = 0x80 | ((c >> 6) & 0x3F);
+            out[2] = 0x80 | (c & 0x3F);
+            break;
+        default:
+            c = 0x10000 + ((c - 0xD800) << 10) + (utf_ld16(src + 2 * i + 2) - 0xDC00);
+            out[0] = 0xF0 | (c >> 18);
+            out[1] = 0x80 | ((c >> 12) & 0x3F);
+            out[2] = 0x80 | ((c >> 6) & 0x3F);
+            out[3] = 0x80 | (c & 0x3F);
+            break;
+    }
+}
+
+uint32_t mof_utf8_len(const void *src, uint32_t units)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0, len = 0, k, n;
+
+    for (;;) {
+        while (units - i >= 8 && utf_ascii8(s + 2 * i)) {
+            i += 8;
+            len += 8;
+        }
+        if (units - i >= 4 && utf_ascii4(utf_ld64(s + 2 * i))) {
+            i += 4;
+            len += 4;
+        }
+        if (i >= units)
+            break;
+        k = utf_one(s, i, units, &n);
+        if (!n)
+            break;
+        i += n;
+        len += k;
+    }
+    return len;
+}
+
+uint32_t mof_utf16_to_utf8(const void *src, uint32_t units, char *out, uint32_t size)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *o = (uint8_t *)out;
+    uint32_t i = 0, j = 0, k, n;
+
+    if (!size)
+        return 0;
+    for (;;) {
+        while (units - i >= 8 && size - j > 8 && utf_ascii8(s + 2 * i)) {
+            utf_st32(o + j, utf_pack4(utf_ld64(s + 2 * i)));
+            utf_st32(o + j + 4, utf_pack4(utf_ld64(s + 2 * i + 8)));
+            i += 8;
+            j += 8;
+        }
+        if (units - i >= 4 && size - j > 4 && utf_ascii4(utf_ld64(s + 2 * i))) {
+            utf_st32(o + j, utf_pack4(utf_ld64(s + 2 * i)));
+            i += 4;
+            j += 4;
+        }
+        if (i >= units)
+            break;
+        k = utf_one(s, i, units, &n);
+        if (!n || size - j <= k)
+            break;
+        utf_put(s, i, k, o + j);
+        i += n;
+        j += k;
+    }
+    o[j] = 0;
+    return j;
+}
+
+uint32_t mof_utf8_len_ref(const void *src, uint32_t units)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint32_t i = 0, len = 0, k, n;
+
+    while (i < units) {
+        k = utf_one(s, i, units, &n);
+        if (!n)
+            break;
+        i += n;
+        len += k;
+    }
+    return len;
+}
+
+uint32_t mof_utf16_to_utf8_ref(const void *src, uint32_t units, char *out, uint32_t size)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    uint8_t *o = (uint8_t *)out;
+    uint32_t i = 0, j = 0, k, n;
+
+    if (!size)
+        return 0;
+    while (i < units) {
+        k = utf_one(s, i, units, &n);
+        if (!n || size - j <= k)
+            break;
+        utf_put(s, i, k, o + j);
+        i += n;
+        j += k;
+    }
+    o[j] = 0;
+    return j;
+}
@@ -0,0 +1,41 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfutf.h
+//  YogaSMC
+//
+//  UTF-16LE to UTF-8 for MOF names and strings.
+//
+#ifndef bmfutf_h
+#define bmfutf_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Both functions read up to units code units from the unaligned src and
+ * stop at the first NUL unit. A surrogate pair becomes one 4-byte
+ * sequence, a lone surrogate is encoded like any other unit.
+ */
+
+// UTF-8 bytes of the string, without the terminating NUL
+uint32_t mof_utf8_len(const void *src, uint32_t units);
+
+/*
+ * Converts into out and NUL terminates it. Sequences that do not fit
+ * into size bytes are dropped whole, so out holds the full string when
+ * size > mof_utf8_len(). Returns the bytes written without the NUL.
+ */
+uint32_t mof_utf16_to_utf8(const void *src, uint32_t units, char *out, uint32_t size);
+
+// One unit per step, same results, for comparison
+uint32_t mof_utf8_len_ref(const void *src, uint32_t units);
+uint32_t mof_utf16_to_utf8_ref(const void *src, uint32_t units, char *out, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* bmfutf_h */
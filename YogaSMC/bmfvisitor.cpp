@@ -0,0 +1,142 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfvisitor.cpp
+//  YogaSMC
+//
+//  Streaming walk over the MOF index, see MOFVisitor.
+//
+
+#include "bmfvisitor.hpp"
+
+// Blocks of a node in buffer order, MOFIndex keeps children in the same order
+static const uint8_t class_blocks[] = {MOF_ROLE_QUALIFIER, MOF_ROLE_VARIABLE, MOF_ROLE_METHOD, MOF_ROLE_NONE};
+static const uint8_t method_blocks[] = {MOF_ROLE_PARAMETER, MOF_ROLE_QUALIFIER, MOF_ROLE_NONE};
+static const uint8_t object_blocks[] = {MOF_ROLE_QUALIFIER, MOF_ROLE_NONE};
+static const uint8_t no_blocks[] = {MOF_ROLE_NONE};
+
+struct mof_walk {
+    const mof_node *node;
+    const uint8_t *block;   // current block, MOF_ROLE_NONE once done
+    uint32_t next;          // next child
+};
+
+int MOFVisitor::enter(const mof_node *node) {
+    if (node->kind == MOF_NODE_CLASS)
+        return beginClass(node);
+    switch (node->role) {
+        case MOF_ROLE_VARIABLE:
+            return property(node);
+
+        case MOF_ROLE_METHOD:
+            return method(node);
+
+        default:
+            return qualifier(node);
+    }
+}
+
+int MOFVisitor::leave(const mof_node *node) {
+    if (node->kind == MOF_NODE_CLASS)
+        return endClass(node);
+    return endItem(node);
+}
+
+// Elements of an array, MOFIndex::scanArray checked them
+int MOFVisitor::entries(const mof_node *node) {
+    uint32_t p = node->value.span.offset;
+    mof_value value;
+    int ret;
+
+    for (uint32_t i=0; i<node->value.size; i++) {
+        p += source->getElement(node, p, &value);
+        ret = valueMapEntry(node, i, &value);
+        if (ret != MOF_VISIT_CONTINUE)
+            return ret;
+    }
+    return MOF_VISIT_CONTINUE;
+}
+
+/*
+ * Depth first on a stack of MOF_MAX_DEPTH entries, the index never nests
+ * deeper, so the walk needs no recursion and no allocation.
+ */
+bool MOFVisitor::walk(MOFIndex *index, const mof_node *node) {
+    mof_walk stack[MOF_MAX_DEPTH], *w = nullptr;
+    const mof_node *child;
+    bool cut = false;
+    int ret;
+
+    source = index;
+    depth = 0;
+    for (;;) {
+        if (node) {
+            w = &stack[depth++];
+            w->node = node;
+            w->next = 0;
+            w->block = no_blocks;
+            ret = enter(node);
+            if (ret == MOF_VISIT_STOP)
+                return false;
+            if (ret == MOF_VISIT_CONTINUE) {
+                switch (node->kind) {
+                    case MOF_NODE_CLASS:
+                        // parameter classes have no qualifiers
+                        w->block = class_blocks + (node->type ? 1 : 0);
+                        break;
+
+                    case MOF_NODE_METHOD:
+                        w->block = method_blocks;
+                        break;
+
+                    case MOF_NODE_OBJECT:
+                        w->block = object_blocks;
+                        break;
+
+                    default:
+                        if ((node->flags & MOF_NODE_ARRAY) && entries(node) == MOF_VISIT_STOP)
+                            return false;
+                        break;
+                }
+            }
+        }
+
+        // next child in the current block, closing the blocks done
+        node = nullptr;
+        while (*w->block != MOF_ROLE_NONE) {
+            child = source->getChild(w->node, w->next);
+            if (child && child->role == *w->block) {
+                w->next++;
+                node = child;
+                break;
+            }
+            ret = endBlock(w->node, *w->block);
+            if (ret == MOF_VISIT_STOP)
+                return false;
+            w->block = ret == MOF_VISIT_SKIP ? no_blocks : w->block + 1;
+        }
+        if (node) {
+            if (depth < MOF_MAX_DEPTH)
+                continue;
+            IOLog("%d: error nesting too deep at %s:%d\n", depth, __func__, __LINE__);
+            w->block = no_blocks;
+            node = nullptr;
+            cut = true;
+        }
+
+        if (leave(w->node) == MOF_VISIT_STOP)
+            return false;
+        if (--depth == 0)
+            return !cut;
+        w = &stack[depth-1];
+    }
+}
+
+int MOFStringVisitor::check(const mof_node *node) {
+    if (depth != 2 || node->role != role || !source->nameEquals(node, name))
+        return MOF_VISIT_SKIP;
+    if (node->kind != MOF_NODE_VALUE || node->type != MOF_STRING || node->flags)
+        return MOF_VISIT_SKIP;
+    vlen = source->getString(node->value.span.offset, node->value.span.len, out, size);
+    match = true;
+    return MOF_VISIT_STOP;
+}
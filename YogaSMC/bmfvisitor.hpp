@@ -0,0 +1,86 @@
+//  SPDX-License-Identifier: GPL-2.0-only
+//
+//  bmfvisitor.hpp
+//  YogaSMC
+//
+//  Streaming walk over the MOF index, see MOFVisitor.
+//
+
+#ifndef bmfvisitor_hpp
+#define bmfvisitor_hpp
+
+#include "bmfindex.hpp"
+
+// What a callback asks of the walk
+enum mof_visit {
+    MOF_VISIT_CONTINUE,
+    MOF_VISIT_SKIP,     // children of the node, or its remaining blocks
+    MOF_VISIT_STOP,     // the whole walk
+};
+
+/*
+ * Callbacks in buffer order, depth first. A class has a qualifier,
+ * variable and method block, a parameter class only the last two, a
+ * method a parameter block and a qualifier block, an object a qualifier
+ * block. endBlock comes after each block, empty ones included, and every
+ * begin has its end unless the walk stops. Array values get one
+ * valueMapEntry per element, see MOFIndex::getElement.
+ *
+ * Nothing is allocated, values are the mof_value of the node and names
+ * are read through source while the walk runs.
+ */
+class MOFVisitor {
+
+public:
+    virtual ~MOFVisitor() {};
+
+    // False when the walk was stopped or cut short
+    bool walk(MOFIndex *index, const mof_node *node);
+
+    virtual int beginClass(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    virtual int endClass(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    virtual int qualifier(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    virtual int property(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    virtual int method(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    // After qualifier, property and method, and their children
+    virtual int endItem(const mof_node *node) {return MOF_VISIT_CONTINUE;};
+    virtual int endBlock(const mof_node *node, uint8_t role) {return MOF_VISIT_CONTINUE;};
+    virtual int valueMapEntry(const mof_node *node, uint32_t i, const mof_value *value) {return MOF_VISIT_CONTINUE;};
+
+protected:
+    MOFIndex *source {nullptr};
+    int depth {0};          // 1 for the node the walk started at
+
+private:
+    int enter(const mof_node *node);
+    int leave(const mof_node *node);
+    int entries(const mof_node *node);
+};
+
+/*
+ * String value of one variable or qualifier of a class, without building
+ * its dictionary, e.g. "__CLASS" with MOF_ROLE_VARIABLE.
+ */
+class MOFStringVisitor : public MOFVisitor {
+
+public:
+    MOFStringVisitor(const char *name, uint8_t role, char *out, uint32_t size) {this->name = name; this->role = role; this->out = out; this->size = size;};
+    // Length of the full value, like MOFIndex::getString, once found
+    bool found(uint32_t *len) {*len = vlen; return match;};
+
+private:
+    virtual int beginClass(const mof_node *node) APPLE_KEXT_OVERRIDE {return depth == 1 ? MOF_VISIT_CONTINUE : MOF_VISIT_SKIP;};
+    virtual int qualifier(const mof_node *node) APPLE_KEXT_OVERRIDE {return check(node);};
+    virtual int property(const mof_node *node) APPLE_KEXT_OVERRIDE {return check(node);};
+    virtual int method(const mof_node *node) APPLE_KEXT_OVERRIDE {return MOF_VISIT_SKIP;};
+    int check(const mof_node *node);
+
+    const char *name;
+    uint8_t role;
+    char *out;
+    uint32_t size;
+    uint32_t vlen {0};
+    bool match {false};
+};
+
+#endif /* bmfvisitor_hpp */